@@ -0,0 +1,85 @@
+#ifndef CAPTURE_REPLAY_H
+#define CAPTURE_REPLAY_H
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <cstdint>
+#include <packet_recorder.h>
+using namespace std;
+
+namespace pepperl_fuchs {
+
+class DataReceiver;
+
+//! \class CaptureReplay
+//! \brief Feeds the records of capture files written by a PacketRecorder into a DataReceiver
+//! The receiver must be constructed with RECEIVE_MODE_INJECT, so the records pass through the same
+//! parsing and scan assembly as live data. Receive times are the recorded ones shifted to the start
+//! of the replay, so scan timestamps are reproduced independent of the replay speed.
+//! Once all records have been replayed, the receiver is disconnected.
+class CaptureReplay
+{
+public:
+    //! Start replaying on a background thread
+    //! @param path Path of a capture file, or the path given to the PacketRecorder for a series of rotated files
+    //! @param receiver Receiver to inject into, must outlive the replay
+    //! @param speed Replay speed relative to the recording, e.g. 1.0 for real time, 0 for as fast as possible
+    CaptureReplay(const string& path, DataReceiver& receiver, double speed = 1.0);
+
+    //! Stop replaying
+    ~CaptureReplay();
+
+    //! Check if capture files have been found
+    bool isOpen() const { return !files_.empty(); }
+
+    //! Check if the replay is still running
+    bool isRunning() const { return running_; }
+
+    //! Stop replaying, the receiver is left connected
+    void stop();
+
+    //! Number of records injected so far
+    uint64_t getReplayedRecords() const { return replayed_records_.load(memory_order_relaxed); }
+
+private:
+    //! Size of the stdio buffer used to read capture files
+    static const size_t READ_BUFFER_SIZE = 1024*1024;
+
+    //! Body of the replay thread
+    void replayLoop();
+
+    //! Inject all records of a single file
+    //! @returns False if the replay has been stopped, true otherwise
+    bool replayFile(FILE* file);
+
+    //! Capture files to replay, in order
+    vector<string> files_;
+
+    //! Receiver to inject into
+    DataReceiver& receiver_;
+
+    //! Replay speed, 0 for as fast as possible
+    const double speed_;
+
+    //! Timestamp of the first record and host time (CLOCK_MONOTONIC, nanoseconds) it has been replayed at
+    int64_t first_timestamp_;
+    int64_t start_time_;
+
+    //! Buffer for the data of a single record
+    vector<char> record_buffer_;
+
+    //! True while the replay thread should keep running
+    atomic<bool> running_;
+
+    //! Number of records injected so far
+    atomic<uint64_t> replayed_records_;
+
+    //! Background thread reading the capture files
+    thread replay_thread_;
+};
+
+}
+
+#endif // CAPTURE_REPLAY_H
@@ -3,101 +3,345 @@
 #define COMMAND_INTERFACE_H
 #include <string>
 #include <map>
-#include <boost/property_tree/ptree.hpp>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/thread.hpp>
+#include <boost/optional.hpp>
 #include <protocol_info.h>
+#include <json_reader.h>
 using namespace std;
 
 namespace pepperl_fuchs {
 
 //! Allows accessing the HTTP/JSON interface
+//! Commands are sent over a small pool of persistent HTTP/1.1 connections, which are established
+//! on demand and transparently reestablished if the scanner closed them.
+//!
+//! Every command is available in three forms: asynchronous with a completion handler, asynchronous
+//! returning a future, and blocking. All forms may be used from any number of threads at once, every
+//! request carries its own response state. A command goes to the connection with the fewest
+//! outstanding requests, a new connection is opened while none is idle and the pool is not full,
+//! otherwise it is written behind the outstanding ones (HTTP pipelining). Commands issued without
+//! waiting for each other may therefore be executed in any order. Handlers are called on the IO
+//! thread and must not block; in particular the blocking commands must not be called from the IO
+//! thread serving the interface.
 class CommandInterface
 {
 public:
-    //! Setup a new HTTP command interface
+    //! Setup a new HTTP command interface, does not connect yet
     //! @param http_ip IP or DNS name of sensor
     //! @param http_port HTTP/TCP port of sensor
-    CommandInterface(const string& http_host, int http_port=80);
+    //! @param io_service Shared io_service to run the connection on, which must be running until the
+    //!                   interface is destroyed. If not given, the interface runs its own IO thread.
+    CommandInterface(const string& http_host, int http_port=80, boost::asio::io_service* io_service = 0);
+
+    //! Fail all pending commands and close the connection
+    //! Does not wait for a shared io_service, so it may be called from any of its handlers or after it has been
+    //! stopped, but not from a completion handler of this interface
+    ~CommandInterface();
 
     //! Get the HTTP hostname/IP of the scanner
     const string& getHttpHost() const { return http_host_; }
 
+    //! Get the io_service the connections run on, shared or owned by the interface
+    boost::asio::io_service& getIoService() { return io_service_; }
+
+    //! Set the maximum number of connections to the scanner, defaults to DEFAULT_MAX_CONNECTIONS
+    //! Connections beyond the limit are closed once their outstanding requests are answered
+    void setMaxConnections(unsigned int max_connections) { max_connections_ = max(max_connections,1u); }
+
+    //! Default maximum number of connections to the scanner
+    static const unsigned int DEFAULT_MAX_CONNECTIONS = 2;
+
+    //! Completion handler of a command returning success or failure
+    typedef function<void(bool)> ResultHandler;
+
     //! Set sensor parameter
     //! @param name Name
     //! @param value Value
     //! @returns True on success, false otherwise
     bool setParameter(const string name, const string value);
+    future<bool> setParameterAsync(const string& name, const string& value);
+    void setParameterAsync(const string& name, const string& value, const ResultHandler& handler);
 
     //! Get sensor parameter
     //! @param name Parameter name
     //! @returns Optional string value with value of given parameter name
     boost::optional<string> getParameter(const string name);
+    future< boost::optional<string> > getParameterAsync(const string& name);
+    void getParameterAsync(const string& name, const function<void(boost::optional<string>)>& handler);
 
     //! Get multiple sensor parameters
     //! @param names Parameter names
     //! @returns vector with string values with the values of the given parameter names
     map< string, string > getParameters( const vector< string >& names );
+    future< map< string, string > > getParametersAsync( const vector< string >& names );
+    void getParametersAsync( const vector< string >& names, const function<void(map< string, string >)>& handler );
 
     //! List available ro/rw parameters
     //! @returns A vector with the names of all available parameters
     vector< string > getParameterList();
+    future< vector< string > > getParameterListAsync();
+    void getParameterListAsync( const function<void(vector< string >)>& handler );
 
     //! Get protocol info (protocol_name, version, commands)
     //! @returns A struct with the requested data
     boost::optional<ProtocolInfo> getProtocolInfo();
+    future< boost::optional<ProtocolInfo> > getProtocolInfoAsync();
+    void getProtocolInfoAsync( const function<void(boost::optional<ProtocolInfo>)>& handler );
 
     //! Request UDP handle
     //! @param port Set UDP port where scanner data should be sent to
-    //! @param hostname Optional: Set hostname/IP where scanner data should be sent to, local IP is determined automatically if not specified
+    //! @param hostname Optional: Set hostname/IP where scanner data should be sent to, local IP is determined automatically if not specified:
+    //!                 it is the local address of the HTTP connections, a connection is established first if there is none yet
     //! @param start_angle Optional: Set start angle for scans in the range [0,3600000] (1/10000°), defaults to -1800000
+    //! @param packet_type Optional: Packet type 'A' (distance), 'B' (distance and amplitude) or 'C' (distance and amplitude packed), defaults to 'C'
     //! @returns A valid HandleInfo on success, an empty boost::optional<HandleInfo> container otherwise
-    boost::optional<HandleInfo> requestHandleUDP(int port, string hostname = string(""), int start_angle=-1800000);
+    boost::optional<HandleInfo> requestHandleUDP(int port, string hostname = string(""), int start_angle=-1800000, char packet_type='C');
+    future< boost::optional<HandleInfo> > requestHandleUDPAsync(int port, string hostname = string(""), int start_angle=-1800000, char packet_type='C');
+    void requestHandleUDPAsync(int port, string hostname, int start_angle, char packet_type, const function<void(boost::optional<HandleInfo>)>& handler);
+
+    //! Request TCP handle
+    //! @param start_angle Optional: Set start angle for scans in the range [0,3600000] (1/10000°), defaults to -1800000
+    //! @param packet_type Optional: Packet type 'A', 'B' or 'C', see requestHandleUDP(), defaults to 'C'
+    //! @returns A valid HandleInfo with the scanner side TCP port on success, an empty boost::optional<HandleInfo> container otherwise
+    boost::optional<HandleInfo> requestHandleTCP(int start_angle=-1800000, char packet_type='C');
+    future< boost::optional<HandleInfo> > requestHandleTCPAsync(int start_angle=-1800000, char packet_type='C');
+    void requestHandleTCPAsync(int start_angle, char packet_type, const function<void(boost::optional<HandleInfo>)>& handler);
 
     //! Release handle
     bool releaseHandle( const string& handle );
+    future<bool> releaseHandleAsync( const string& handle );
+    void releaseHandleAsync( const string& handle, const ResultHandler& handler );
 
     //! Initiate output of scan data
     bool startScanOutput( const string& handle );
+    future<bool> startScanOutputAsync( const string& handle );
+    void startScanOutputAsync( const string& handle, const ResultHandler& handler );
 
     //! Terminate output of scan data
     bool stopScanOutput( const string& handle );
+    future<bool> stopScanOutputAsync( const string& handle );
+    void stopScanOutputAsync( const string& handle, const ResultHandler& handler );
 
     //! Feed the watchdog to keep the handle alive
     bool feedWatchdog( const string& handle );
+    future<bool> feedWatchdogAsync( const string& handle );
+    void feedWatchdogAsync( const string& handle, const ResultHandler& handler );
 
     //! Reboot laserscanner
     bool rebootDevice();
+    future<bool> rebootDeviceAsync();
+    void rebootDeviceAsync( const ResultHandler& handler );
 
     //! Reset laserscanner parameters to factory default
     //! @param names Names of parameters to reset
     bool resetParameters(const vector< string >& names);
+    future<bool> resetParametersAsync(const vector< string >& names);
+    void resetParametersAsync(const vector< string >& names, const ResultHandler& handler);
 
     //! Discovers the local IP of the NIC which talks to the laser range finder
     //! @returns The local IP as a string, an empty string otherwise
     string discoverLocalIP();
 
 private:
+    //! Completion handler of a HTTP request: status code (0 in case of an error) and content
+    //! The content points into the receive buffer and is only valid during the call
+    typedef function<void(int, const char*, size_t)> HttpHandler;
+
+    //! Completion handler of a command: success of request and error code check, and the parsed JSON
+    //! The reader refers to the receive buffer and is only valid during the call
+    typedef function<void(bool, const JsonReader&)> CommandHandler;
+
+    //! \struct HttpRequest
+    //! \brief A queued HTTP request
+    struct HttpRequest
+    {
+        //! Complete request including headers
+        string data;
+
+        //! Called with the response, or with status code 0 after an error
+        HttpHandler handler;
+
+        //! Number of times the request has been sent
+        unsigned int attempts;
+
+        //! True if the request has been sent on a connection which has been used before
+        bool reused;
+
+        //! True if executing the request twice does no harm, only such requests are sent again once written
+        bool idempotent;
+    };
+
+    //! \struct Connection
+    //! \brief A connection of the pool and the requests assigned to it (strand only)
+    //! Operations on the connection keep it alive, as they still access socket and buffers when aborted
+    struct Connection : enable_shared_from_this<Connection>
+    {
+        Connection(boost::asio::io_service& io_service) : socket(io_service), timer(io_service), num_sent(0),
+            connecting(false), writing(false), reading(false), timed_out(false), responses(0), response_status(0),
+            response_content_length(0), response_has_content_length(false), response_keep_alive(false) {}
+
+        //! Socket, closed if not established yet
+        boost::asio::ip::tcp::socket socket;
+
+        //! Timeout of the pending requests
+        boost::asio::steady_timer timer;
+
+        //! Requests in the order they are sent, the first num_sent ones have been written
+        deque< shared_ptr<HttpRequest> > requests;
+
+        //! Number of requests written and waiting for their response
+        size_t num_sent;
+
+        //! Connection state
+        bool connecting;
+        bool writing;
+        bool reading;
+        bool timed_out;
+
+        //! Number of responses received since the connection has been established
+        unsigned int responses;
+
+        //! Requests currently being written, concatenated
+        string write_buffer;
+
+        //! Response buffer, may hold the beginning of the next pipelined response
+        boost::asio::streambuf response;
+
+        //! State of the response being read
+        int response_status;
+        size_t response_content_length;
+        bool response_has_content_length;
+        bool response_keep_alive;
+    };
+
+    //! \struct HandlerGuard
+    //! \brief State shared with the handlers queued on the io_service
+    //! Handlers run with the mutex locked and skip the interface once it has been destroyed, so the
+    //! destructor never waits for handlers of a shared io_service, which may be stopped or run by the calling thread
+    struct HandlerGuard
+    {
+        recursive_mutex mutex;
+        CommandInterface* command_interface;
+    };
+
+    //! \struct GuardedHandler
+    //! \brief Completion handler which is only called while the interface exists, see HandlerGuard
+    template<class Handler>
+    struct GuardedHandler
+    {
+        shared_ptr<HandlerGuard> guard;
+        Handler handler;
+
+        //! Connection the operation runs on, if any
+        shared_ptr<Connection> connection;
+
+        template<class... Args>
+        void operator()(const Args&... args)
+        {
+            lock_guard<recursive_mutex> lock(guard->mutex);
+            if( guard->command_interface )
+                handler(args...);
+        }
+    };
+
+    //! Bind a handler to handler_guard_, to be passed to strand_.post() or strand_.wrap()
+    //! @param handler Handler to call while the interface exists
+    //! @param connection Connection to keep alive until the handler has been called or destroyed
+    template<class Handler>
+    GuardedHandler<Handler> guarded(const Handler& handler, Connection* connection = 0) const
+    {
+        GuardedHandler<Handler> guarded_handler = { handler_guard_, handler,
+                                                    connection ? connection->shared_from_this() : shared_ptr<Connection>() };
+        return guarded_handler;
+    }
 
-    //! Send a HTTP-GET request to http_ip_ at http_port_
-    //! @param requestStr The last part of an URL with a slash leading
-    //! @param header  The response header returned as string, empty string in case of an error
-    //! @param content The response content returned as string, empty string in case of an error
-    //! @returns The HTTP status code or 0 in case of an error
-    int httpGet(const string request_path, string& header, string& content);
+    //! Maximum number of requests sent ahead of their responses on a connection
+    static const size_t MAX_PIPELINED_REQUESTS = 8;
+
+    //! Time after which a request without any progress fails, in milliseconds
+    static const int REQUEST_TIMEOUT_MS = 5000;
+
+    //! Queue a HTTP-GET request to http_ip_ at http_port_
+    //! A request failing on a reused connection, e.g. because the scanner closed it meanwhile,
+    //! is retried once on a new connection if it is idempotent or has not been written yet
+    //! @param request_path The last part of an URL with a slash leading
+    //! @param idempotent True if the scanner may execute the request twice
+    //! @param handler Called on the IO thread with the status code and content
+    void httpGetAsync(const string& request_path, bool idempotent, const HttpHandler& handler);
+
+    //! Check if a command only reads state or may be repeated without effect, e.g. get_* and feed_watchdog
+    static bool isIdempotentCommand(const string& cmd);
 
     //! Send a sensor specific HTTP-Command
     //! @param cmd command name
     //! @param keys_values parameter->value map, which is encoded in the GET-request: ?p1=v1&p2=v2
-    bool sendHttpCommand(const string cmd, const map< string, string > param_values );
+    //! @param handler Called on the IO thread with the parsed response
+    void sendHttpCommand(const string& cmd, const map< string, string >& param_values, const CommandHandler& handler);
 
     //! Send a sensor specific HTTP-Command with a single parameter
     //! @param cmd Command name
     //! @param param Parameter
     //! @param value Value
-    bool sendHttpCommand(const string cmd, const string param = "", const string value = "" );
+    //! @param handler Called on the IO thread with the parsed response
+    void sendHttpCommand(const string& cmd, const string& param, const string& value, const CommandHandler& handler);
+
+    //! Send a sensor specific HTTP-Command which only reports success
+    void sendResultCommand(const string& cmd, const string& param, const string& value, const ResultHandler& handler);
 
-    //! Check the error code and text of the returned JSON by the last request
+    //! Check the error code and text of a returned JSON
     //! @returns False in case of an error, True otherwise
-    bool checkErrorCode();
+    static bool checkErrorCode(const JsonReader& json);
+
+    //! Assign queued requests to connections and start connecting or writing (strand only)
+    void startRequests();
+
+    //! Connect, or write the requests assigned to a connection, as far as its state allows (strand only)
+    void startConnection(Connection& connection);
+
+    //! Resolve the endpoint once and start connecting (strand only)
+    void startConnect(Connection& connection);
+
+    //! Connection has been established or failed
+    void handleConnect(Connection& connection, const boost::system::error_code& error);
+
+    //! Requests have been written
+    void handleWrite(Connection& connection, const boost::system::error_code& error);
+
+    //! Start reading the response to the oldest request sent (strand only)
+    void startRead(Connection& connection);
+
+    //! Status line and headers of a response have been read
+    void handleReadHeader(Connection& connection, const boost::system::error_code& error, size_t header_size);
+
+    //! Content of a response has been read
+    void handleReadContent(Connection& connection, const boost::system::error_code& error);
+
+    //! Close the connection after an error, retry or fail the requests sent on it (strand only)
+    void handleError(Connection& connection, const boost::system::error_code& error);
+
+    //! No progress within REQUEST_TIMEOUT_MS
+    void handleTimeout(Connection& connection, const boost::system::error_code& error);
+
+    //! (Re)start the timeout of the pending requests (strand only)
+    void startTimer(Connection& connection);
+
+    //! Fail the given requests (strand only)
+    void failRequests(deque< shared_ptr<HttpRequest> >& requests);
+
+    //! Fail all queued requests and close all connections (strand or destructor only)
+    void shutdown();
+
+    //! Close a connection and discard buffered data (strand only)
+    void closeConnection(Connection& connection);
 
     //! Scanner IP
     string http_host_;
@@ -105,12 +349,44 @@ private:
     //! Port of HTTP-Interface
     int http_port_;
 
-    //! Returned JSON as property_tree
-    boost::property_tree::ptree pt_;
+    //! Own io_service if no shared one has been passed
+    unique_ptr<boost::asio::io_service> own_io_service_;
+
+    //! io_service of the HTTP connections
+    boost::asio::io_service& io_service_;
+
+    //! Keeps the own io_service running while there is no request
+    unique_ptr<boost::asio::io_service::work> io_work_;
+
+    //! IO thread running the own io_service
+    boost::thread io_service_thread_;
+
+    //! Serializes all handlers touching the connection state
+    boost::asio::io_service::strand strand_;
+
+    //! Resolved endpoints of the scanner, cached for reconnects
+    vector<boost::asio::ip::tcp::endpoint> endpoints_;
+
+    //! Local address of the last established connection, empty if none has been established yet (strand only)
+    string local_address_;
+
+    //! Maximum number of connections
+    atomic<unsigned int> max_connections_;
+
+    //! Connection pool
+    vector< shared_ptr<Connection> > connections_;
+
+    //! Requests not assigned to a connection yet, in the order they have been issued
+    deque< shared_ptr<HttpRequest> > requests_;
+
+    //! Set by the destructor, new requests fail immediately
+    bool shutting_down_;
 
-    //! HTTP-Status code of last request
-    int http_status_code_;
+    //! Reader for the JSON responses, reused to keep its buffers (strand only)
+    JsonReader json_reader_;
 
+    //! Shared with the handlers queued on the io_service, see HandlerGuard
+    shared_ptr<HandlerGuard> handler_guard_;
 };
 }
 
@@ -5,62 +5,321 @@
 #define BOOST_CB_DISABLE_DEBUG
 #include <string>
 #include <iostream>
-#include <mutex>
-#include <condition_variable>
-#include <deque>
 #include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <sys/socket.h>
 #include <boost/bind.hpp>
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
 #include <boost/circular_buffer.hpp>
 #include <packet_structure.h>
+#include <spsc_queue.h>
+#include <scan_subscription.h>
+#include <receiver_stats.h>
+#include <receiver_options.h>
+#include <scanner_clock.h>
+#include <packet_recorder.h>
 using namespace std;
 
 namespace pepperl_fuchs {
 
 //! Receives data of the laser range finder via IP socket
 //! Receives the scanner data with asynchronous functions of the Boost::Asio library
+//! UDP datagrams are stamped by the kernel on arrival (SO_TIMESTAMPNS), these receive times feed a
+//! clock model which maps the scanner timestamps of scans and sectors to host CLOCK_MONOTONIC
 class DataReceiver
 {
 public:
 
     //! Open an UDP port and listen on it
-    DataReceiver();
+    //! @param receive_mode Read one datagram per wakeup or drain the socket in batches
+    //! @param io_service Shared io_service to run the socket handlers on, which must be running until
+    //!                   the receiver is destroyed. If not given, the receiver runs its own IO thread.
+    DataReceiver(ReceiveMode receive_mode = RECEIVE_MODE_ASYNC, boost::asio::io_service* io_service = 0);
+
+    //! Open an UDP port with the given socket and IO thread settings and listen on it
+    //! @param options Receive mode, socket and IO thread settings
+    //! @param io_service Shared io_service to run the socket handlers on, see above
+    DataReceiver(const ReceiverOptions& options, boost::asio::io_service* io_service = 0);
+
+    //! Connect to the TCP port of a scanner handle and receive the packet stream from it
+    //! @param hostname IP or hostname of laserscanner
+    //! @param tcp_port TCP port returned with the handle
+    //! @param io_service Shared io_service to run the socket handlers on, see above
+    //! @param options Socket and IO thread settings, receive mode and local address are ignored
+    DataReceiver(const string& hostname, int tcp_port, boost::asio::io_service* io_service = 0,
+                 const ReceiverOptions& options = ReceiverOptions());
 
     //! Disconnect cleanly
+    //! Must not be called from a callback of this receiver
     ~DataReceiver();
 
     //! Get open and receiving UDP port
+    //! @returns UDP port, -1 in case of a TCP receiver
     int getUDPPort() const { return udp_port_; }
 
     //! Return connection status
     bool isConnected() const { return is_connected_; }
 
     //! Disconnect and cleanup
+    //! Does not wait for a shared io_service, so it may be called from any of its handlers or after it has been stopped
     void disconnect();
 
     //! Pop a single full scan out of the internal FIFO queue if there is any
     //! If no full scan is available yet, blocks until a full scan is available
+    //! Must only be called from a single consumer thread
     //! @returns A ScanData struct with distance and amplitude data as well as the packet headers belonging to the data
     ScanData getFullScan();
 
+    //! Hand a scan obtained by getFullScan() back to the receiver, its buffers are reused for upcoming scans
+    //! Must only be called from the consumer thread calling getFullScan()
+    //! @param scan Scan to recycle, left empty
+    void releaseScan(ScanData&& scan);
+
+    //! Replace the set of scan subscribers
+    //! While there is at least one subscriber, completed scans are passed to the subscribers
+    //! right after their last packet arrived instead of being queued for getFullScan()
+    //! @param subscriptions Subscribers to call for every completed scan
+    void setScanSubscriptions(const vector<ScanSubscription>& subscriptions);
+
+    //! Replace the set of sector subscribers, takes effect with the next scan
+    //! Sectors are handed out in addition to the delivery of complete scans
+    //! @param subscriptions Subscribers to call for every completed sector
+    void setSectorSubscriptions(const vector<SectorSubscription>& subscriptions);
+
+    //! Get a snapshot of the receiver counters
+    ReceiverStats getStats() const;
+
+    //! Get the settings in effect, as reported by the kernel after applying the requested options
+    //! Options which could not be applied hold their default value
+    const ReceiverOptions& getEffectiveOptions() const { return effective_options_; }
+
+    //! Get the host time (CLOCK_MONOTONIC, nanoseconds) the last valid packet arrived at
+    //! @returns Receive time, 0 if no packet has been received yet
+    int64_t getLastPacketTime() const { return last_packet_time_.load(memory_order_relaxed); }
+
+    //! Get the expected interval between two packets, derived from scan frequency and packets per scan
+    //! @returns Interval in nanoseconds, 0 as long as no scan has been started
+    int64_t getPacketInterval() const { return packet_interval_.load(memory_order_relaxed); }
+
+    //! Mark an interruption of the data stream, e.g. detected by a link monitor
+    //! The scan in progress is handed over with the next packet, and the first scan started
+    //! afterwards is delivered with ScanData::gap_before set
+    void markGap() { gap_pending_.store(true,memory_order_relaxed); }
+
+    //! Pass data to the parser of a receiver constructed with RECEIVE_MODE_INJECT, as if it had
+    //! been received from the socket. The calling thread takes the role of the IO thread, so
+    //! only a single thread may inject data.
+    //! @param data One datagram or any chunk of the TCP stream
+    //! @param size Number of bytes
+    //! @param receive_time Host time (CLOCK_MONOTONIC, nanoseconds) to assume as receive time
+    void injectData(char* data, size_t size, int64_t receive_time);
+
+    //! Record the received data, i.e. every UDP datagram or every chunk of the TCP stream
+    //! The IO thread only copies the data into the buffer of the recorder, which writes it to disk
+    //! Returns once the IO thread does not feed the previous recorder anymore, so it can be closed right away
+    //! @param recorder Recorder to feed, 0 to stop recording
+    void setRecorder(const shared_ptr<PacketRecorder>& recorder);
+
+    //! Set the time without any data after which getFullScan() disconnects the receiver
+    //! @param timeout_ns Timeout in nanoseconds (2 s by default), 0 to leave this to the caller
+    void setDataTimeout(int64_t timeout_ns) { data_timeout_.store(timeout_ns,memory_order_relaxed); }
+
 
 private:
 
-    //! Asynchronous callback function, called if data has been reveived by the UDP socket
+    //! \struct HandlerGuard
+    //! \brief State shared with the socket handlers queued on the io_service
+    //! Handlers run with the mutex locked and skip the receiver once it has been destroyed, so
+    //! disconnecting or destroying the receiver never waits for handlers still queued on a shared io_service
+    struct HandlerGuard
+    {
+        recursive_mutex mutex;
+        DataReceiver* receiver;
+    };
+
+    //! \struct OpenScan
+    //! \brief A scan assembled by the IO thread together with the state of its packets
+    struct OpenScan
+    {
+        OpenScan() : scan_number(0), packet_type(PACKET_TYPE_C), received_points(0), points_per_packet(0) {}
+
+        //! Points and headers received so far, the scan is open while it holds any header
+        ScanData scan;
+
+        //! Scan number of the scan
+        uint16_t scan_number;
+
+        //! Packet type of the scan
+        uint16_t packet_type;
+
+        //! Bitmap of received packets, bit (packet_number-1)
+        vector<uint64_t> received_packets;
+
+        //! Number of points received so far
+        size_t received_points;
+
+        //! Number of points of all but the last packet
+        size_t points_per_packet;
+
+        //! Sector subscribers for the scan, snapshot taken when the scan started
+        shared_ptr< const vector<SectorSubscription> > sector_subscriptions;
+
+        //! Sector size in points of each sector subscriber
+        vector<size_t> sector_sizes;
+
+        //! Bitmap of the sectors handed out to each sector subscriber, bit first_index/sector_size
+        vector< vector<uint64_t> > emitted_sectors;
+    };
+
+    //! Number of packets of the next scan to wait for reordered packets of an incomplete scan
+    static const size_t REORDER_WINDOW_PACKETS = 4;
+
+    //! Number of datagrams fetched with a single recvmmsg() call in batch mode
+    static const size_t BATCH_SIZE = 64;
+
+    //! Size of a single datagram slot in batch mode, larger than any packet sent by the scanner
+    //! In async mode the single slot takes any datagram, see CAPTURE_MAX_RECORD_SIZE
+    static const size_t BATCH_SLOT_SIZE = 2048;
+
+    //! Size of the ancillary data buffer of a datagram slot, takes the receive timestamp and drop counter
+    static const size_t BATCH_CONTROL_SIZE = 64;
+
+    //! Initialize members common to UDP and TCP receivers
+    //! @param io_service Shared io_service, or 0 to create an own one
+    void initialize(boost::asio::io_service* io_service);
+
+    //! Apply the socket related options_ to a freshly created socket and record the effective values
+    //! @param fd Native socket handle
+    void applySocketOptions(int fd);
+
+    //! Apply the IO thread related options_ to the own IO thread and record the effective values
+    void applyThreadOptions();
+
+    //! Issue the next asynchronous read on the UDP or TCP socket according to the receive mode
+    void startReceive();
+
+    //! Asynchronous callback function, called if data has been reveived by the TCP socket
     void handleSocketRead(const boost::system::error_code& error, size_t bytes_transferred);
 
+    //! Asynchronous callback function, called if the UDP socket became readable
+    //! Reads one datagram, or drains the socket in batch mode
+    void handleSocketReadable(const boost::system::error_code& error);
+
+    //! Evaluate the ancillary data of a datagram: take over the kernel drop counter and get the receive time
+    //! @param msg Message header filled by recvmmsg()
+    //! @param realtime_offset_ns Difference between CLOCK_REALTIME and CLOCK_MONOTONIC
+    //! @param now_ns Current host time, returned if the datagram carries no timestamp
+    //! @returns Receive time (CLOCK_MONOTONIC, nanoseconds)
+    int64_t handleControlMessages(const msghdr& msg, int64_t realtime_offset_ns, int64_t now_ns);
+
+    //! Report a socket error and disconnect
+    void handleSocketError(const boost::system::error_code& error);
+
+    //! Close the sockets, must be called on the IO thread, after it has been stopped or with the handler guard locked
+    void closeSockets();
+
+    //! Socket handlers bound to the handler guard instead of the receiver, see HandlerGuard
+    static void guardedSocketRead(const shared_ptr<HandlerGuard>& guard, const boost::system::error_code& error, size_t bytes_transferred);
+    static void guardedSocketReadable(const shared_ptr<HandlerGuard>& guard, const boost::system::error_code& error);
+
+    //! Parse a received datagram or a chunk of the TCP stream
+    //! Datagrams of an UDP receiver hold whole packets and are dropped if invalid, the internal
+    //! ring buffer only reassembles packets of the TCP stream or of injected data
+    //! @param data Received data
+    //! @param size Size of the data in bytes
+    void handleReceivedData(char* data, size_t size);
+
     //! Try to read and parse next packet from the internal ring buffer
     //! @returns True if a packet has been parsed, false otherwise
     bool handleNextPacket();
 
-    //! Search for magic header bytes in the internal ring buffer
-    //! @returns Position of possible packet start, which normally should be zero
+    //! Validate a packet in place and decode its payload into the current scan
+    //! @param data Pointer to the first byte of the packet (magic bytes)
+    //! @param size Number of valid bytes available at data
+    //! @returns True if a complete and valid packet has been decoded, false otherwise
+    bool handlePacket(const char* data, size_t size);
+
+    //! Check if a packet belongs to an open scan
+    //! @param open Scan to check, either current_scan_ or previous_scan_
+    //! @param header Header of the packet
+    //! @returns True if the scan is open and scan number, size and packet type match
+    static bool isOpenScan(const OpenScan& open, const PacketHeader& header);
+
+    //! Decode the payload of a packet into a scan at its first_index
+    //! @tparam Payload Layout and decoder of the packet type, see PacketPayload
+    //! @param scandata Scan the packet belongs to
+    //! @param header Header of the packet
+    //! @param payload First byte of the payload
+    template<class Payload>
+    void decodePayload(ScanData& scandata, const PacketHeader& header, const char* payload);
+
+    //! Check magic bytes, packet type and sizes of a packet header
+    //! @param header Header to check
+    //! @param size Number of bytes available for header and payload
+    //! @returns True if the header describes a complete packet within size bytes
+    static bool isValidPacket(const PacketHeader& header, size_t size);
+
+    //! Search for magic header bytes in the internal ring buffer, starting at resync_offset_
+    //! Scans the linear spans of the ring buffer with memchr(), so every byte is searched only once.
+    //! Sets resync_offset_ to the number of leading bytes which can not belong to a packet.
+    //! @returns Position of possible packet start, which normally should be zero, -1 if none found
     int findPacketStart();
 
-    //! Try to read a packet from the internal ring buffer
-    //! @returns True on success, False otherwise
-    bool retrievePacket( size_t start, PacketTypeC* p );
+    //! Prepare a closed scan for a new scan: take a recycled buffer if possible and reserve space for all points
+    //! @param open Scan to prepare, either current_scan_ or previous_scan_
+    //! @param header Header of the first received packet of the new scan
+    void prepareScan(OpenScan& open, const PacketHeader& header);
+
+    //! Append a scan to the consumer queue according to the queue policy
+    //! @param scandata Scan to append, receives an empty slot or an evicted scan in exchange
+    void enqueueScan(ScanData& scandata);
+
+    //! Hand an open scan over to the consumer queue and close it
+    //! Missing ranges of an incomplete scan are marked as invalid before
+    //! @param open Scan to hand over, either current_scan_ or previous_scan_
+    void pushScan(OpenScan& open);
+
+    //! Hand over previous_scan_ and current_scan_ in this order, if open
+    void pushOpenScans();
+
+    //! Pass a scan to all subscribers
+    //! @param scandata Scan to pass
+    //! @param subscriptions Current set of subscribers
+    void notifyScanSubscribers(const ScanData& scandata, const vector<ScanSubscription>& subscriptions);
+
+    //! Host time of a point of a scan, mapped from the scanner clock
+    //! @param header Header of a received packet of the scan
+    //! @param index Index of the point within the scan
+    //! @returns Host time (CLOCK_MONOTONIC, nanoseconds)
+    int64_t getPointHostTime(const PacketHeader& header, size_t index) const;
+
+    //! Hand out the sectors of an open scan overlapping a range of points, which have not been handed out yet
+    //! @param open Scan to hand out the sectors of
+    //! @param first_index Index of the first point of the range
+    //! @param end_index Index behind the last point of the range
+    //! @param force Hand out incomplete sectors too, as their missing packets will not arrive anymore
+    void emitSectors(OpenScan& open, size_t first_index, size_t end_index, bool force);
+
+    //! Check if all packets covering a range of points of an open scan have been received
+    //! @param open Scan to check
+    //! @param first_index Index of the first point of the range
+    //! @param end_index Index behind the last point of the range
+    //! @returns True if no point of the range is missing
+    static bool hasPackets(const OpenScan& open, size_t first_index, size_t end_index);
+
+    //! Check if a packet belongs to a scan which has already been handed over
+    //! @param scan_number Scan number of the packet
+    //! @returns True for packets of the last pushed scan or shortly before
+    bool isLateScan(uint16_t scan_number) const;
+
+    //! Pass received data to the recorder, if recording
+    //! @param data Datagram or chunk of the TCP stream as received
+    //! @param size Number of bytes
+    //! @param timestamp Receive time (CLOCK_REALTIME, nanoseconds)
+    void recordData(const char* data, size_t size, int64_t timestamp);
 
     //! Checks if the connection is alive
     //! @returns True if connection is alive, false otherwise
@@ -80,11 +339,17 @@ private:
     int udp_port_;
 
     //! Internal connection state
-    bool is_connected_;
+    atomic<bool> is_connected_;
 
-    //! Event handler thread
+    //! Event handler thread, only used if the io_service is owned by the receiver
     boost::thread io_service_thread_;
-    boost::asio::io_service io_service_;
+    boost::asio::io_service* io_service_;
+
+    //! True if io_service_ has been created by the receiver and is run by io_service_thread_
+    bool owns_io_service_;
+
+    //! Shared with the socket handlers queued on the io_service, see HandlerGuard
+    shared_ptr<HandlerGuard> handler_guard_;
 
     //! Boost::Asio streambuffer
     boost::asio::streambuf inbuf_;
@@ -95,26 +360,132 @@ private:
     //! Receiving socket
     boost::asio::ip::udp::socket* udp_socket_;
 
-    //! Endpoint in case of UDP receiver
-    boost::asio::ip::udp::endpoint udp_endpoint_;
+    //! Receiving socket in case of TCP receiver
+    boost::asio::ip::tcp::socket* tcp_socket_;
+
+    //! Buffer for reads from the TCP stream, its size bounds the records written to a PacketRecorder
+    array< char, CAPTURE_MAX_RECORD_SIZE > udp_buffer_;
 
-    //! Buffer in case of UDP receiver
-    array< char, 65536 > udp_buffer_;
+    //! Selected strategy for reading the UDP socket
+    ReceiveMode receive_mode_;
+
+    //! Requested socket and IO thread settings
+    ReceiverOptions options_;
+
+    //! Settings in effect
+    ReceiverOptions effective_options_;
+
+    //! Preallocated datagram slots, message headers, io vectors and ancillary data for recvmmsg()
+    //! A single slot in async mode, BATCH_SIZE slots in batch mode, the io vectors point into batch_buffer_
+    vector< char > batch_buffer_;
+    vector< mmsghdr > batch_msgs_;
+    vector< iovec > batch_iovecs_;
+    vector< array< char, BATCH_CONTROL_SIZE > > batch_controls_;
+
+    //! Receive time (CLOCK_MONOTONIC, nanoseconds) of the data currently parsed
+    int64_t receive_time_;
+
+    //! Maps scanner timestamps to host time, updated with every packet
+    ScannerClock scanner_clock_;
+
+    //! Number of datagrams read from the socket
+    atomic<uint64_t> stat_datagrams_;
+
+    //! Number of datagrams larger than their slot
+    atomic<uint64_t> stat_datagrams_truncated_;
+
+    //! Number of datagrams which were no sequence of valid packets
+    atomic<uint64_t> stat_datagrams_invalid_;
+
+    //! Number of socket wakeups
+    atomic<uint64_t> stat_wakeups_;
+
+    //! Scan and packet counters, see ReceiverStats
+    atomic<uint64_t> stat_bytes_;
+    atomic<uint64_t> stat_packets_;
+    atomic<uint64_t> stat_scans_completed_;
+    atomic<uint64_t> stat_scans_incomplete_;
+    atomic<uint64_t> stat_scans_dropped_;
+    atomic<uint64_t> stat_producer_blocks_;
+    atomic<uint64_t> stat_queue_high_water_;
+
+    //! Time spent parsing received data
+    AtomicHistogram stat_parse_time_;
+
+    //! Time from receiving the last packet of a scan until its delivery
+    AtomicHistogram stat_delivery_latency_;
+
+    //! Number of times the ring buffer had to skip data to find the next packet start
+    atomic<uint64_t> stat_resyncs_;
+
+    //! Number of bytes skipped while resyncing
+    atomic<uint64_t> stat_skipped_bytes_;
+
+    //! Number of datagrams dropped by the kernel due to a full receive buffer (SO_RXQ_OVFL)
+    atomic<uint64_t> stat_kernel_drops_;
+
+    //! Latest state of the clock model, see ReceiverStats
+    atomic<int64_t> stat_clock_offset_;
+    atomic<double> stat_clock_drift_;
+    atomic<int64_t> stat_stack_latency_;
+    atomic<int64_t> stat_transfer_latency_;
 
     //! Internal ringbuffer for temporarily storing reveived data
     boost::circular_buffer<char> ring_buffer_;
 
-    //! Protection against data races between ROS and IO threads
-    mutex data_mutex_;
+    //! Number of leading bytes of the ring buffer known not to contain a packet start
+    size_t resync_offset_;
+
+    //! Scan currently assembled by the IO thread, the newest scan packets have been received of
+    OpenScan current_scan_;
+
+    //! Scan before current_scan_, stays open for REORDER_WINDOW_PACKETS packets of current_scan_ if incomplete
+    OpenScan previous_scan_;
+
+    //! Scan number of the last scan handed over to the consumer queue
+    uint16_t last_scan_number_;
+
+    //! Set once a scan has been handed over, last_scan_number_ is valid then
+    bool has_last_scan_;
+
+    //! Lock-free hand-off of completed scans from the IO thread to the consumer
+    SpscQueue<ScanData> scan_queue_;
+
+    //! Scan buffers released by the consumer, waiting to be reused by the IO thread
+    SpscQueue<ScanData> free_scans_;
+
+    //! Current set of scan subscribers, replaced as a whole on every change
+    shared_ptr< const vector<ScanSubscription> > scan_subscriptions_;
+
+    //! Current set of sector subscribers, replaced as a whole on every change
+    shared_ptr< const vector<SectorSubscription> > sector_subscriptions_;
+
+    //! Protects the subscription pointers, never held while calling subscribers
+    mutex subscription_mutex_;
+
+    //! Recorder fed with the received data, 0 if not recording
+    shared_ptr<PacketRecorder> recorder_;
+
+    //! Set while recorder_ is not 0, spares the IO thread the lock if not recording
+    atomic<bool> is_recording_;
+
+    //! Protects the recorder pointer, held by the IO thread while feeding a record
+    mutex recorder_mutex_;
+
+    //! Host time (CLOCK_MONOTONIC, nanoseconds), when last data was received
+    atomic<int64_t> last_data_time_;
+
+    //! Time without data after which getFullScan() disconnects, 0 to never disconnect (nanoseconds)
+    atomic<int64_t> data_timeout_;
 
-    //! Data notification condition variable
-    condition_variable data_notifier_;
+    //! Host time (CLOCK_MONOTONIC, nanoseconds) the last valid packet arrived at, 0 before the first one
+    atomic<int64_t> last_packet_time_;
 
-    //! Double ended queue with sucessfully received and parsed data, organized as single complete scans
-    deque<ScanData> scan_data_;
+    //! Expected interval between two packets in nanoseconds, updated with every new scan
+    atomic<int64_t> packet_interval_;
 
-    //! time in seconds since epoch, when last data was received
-    double last_data_time_;
+    //! Set by markGap(), taken over by the next scan started
+    atomic<bool> gap_pending_;
 };
 
 }
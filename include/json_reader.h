@@ -0,0 +1,139 @@
+#ifndef JSON_READER_H
+#define JSON_READER_H
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <boost/optional.hpp>
+using namespace std;
+
+namespace pepperl_fuchs {
+
+//! \struct JsonToken
+//! \brief A string, number or literal within the parsed data
+struct JsonToken
+{
+    //! Text of the token without quotes, still escaped if escaped is true
+    const char* data;
+
+    //! Number of bytes of the text
+    size_t size;
+
+    //! True if the text contains escape sequences
+    bool escaped;
+
+    //! Check if the unescaped text equals the given string
+    bool equals(const char* str, size_t length) const;
+
+    //! Get the unescaped text
+    string str() const;
+
+    //! Append the unescaped text to the given string
+    void appendTo(string& out) const;
+
+    //! Parse the text as decimal integer, e.g. 50 or "50"
+    boost::optional<long long> toInteger() const;
+};
+
+//! \class JsonReader
+//! \brief Single pass reader for the JSON objects returned by the scanner
+//! The scanner answers every command with a flat object whose values are strings, numbers, literals
+//! or arrays of these. The reader records the position of every member within the data instead of
+//! building a tree, so parsing does not allocate once the reader has been used before. Values are
+//! only copied when they are requested. Nested objects and arrays are accepted but their content
+//! is not accessible.
+class JsonReader
+{
+public:
+    //! \struct Member
+    //! \brief A member of the parsed object
+    struct Member
+    {
+        //! Name of the member
+        JsonToken name;
+
+        //! Value, for arrays the whole text between the brackets
+        JsonToken value;
+
+        //! True if the value is a string
+        bool is_string;
+
+        //! True if the value is an array
+        bool is_array;
+
+        //! Range of the array elements in the element list of the reader
+        size_t first_element;
+        size_t num_elements;
+    };
+
+    JsonReader() : begin_(0), end_(0), pos_(0) {}
+
+    //! Parse a JSON object, the data must stay valid while values are accessed
+    //! @param data Text of the object, not null terminated
+    //! @param size Number of bytes
+    //! @returns True on success, false if the data is no valid JSON object
+    bool parse(const char* data, size_t size);
+
+    //! Number of members of the parsed object
+    size_t size() const { return members_.size(); }
+
+    //! Get a member by index, in the order of the data
+    const Member& member(size_t index) const { return members_[index]; }
+
+    //! Find a member by name
+    //! @param name Name of the member
+    //! @param hint Index to start searching at, e.g. the index after the previously found member
+    //! @returns Index of the member, or size() if it does not exist
+    size_t find(const string& name, size_t hint=0) const;
+
+    //! Get the value of a member as string, numbers and literals as written
+    //! @returns The value, or an empty container if the member does not exist or is no scalar
+    boost::optional<string> getString(const string& name) const;
+
+    //! Get the value of a member as integer
+    //! @returns The value, or an empty container if the member does not exist or is no integer
+    boost::optional<int> getInt(const string& name) const;
+
+    //! Get an array of scalars as strings
+    //! @returns True if the member exists and is an array, false otherwise
+    bool getStringArray(const string& name, vector<string>& values) const;
+
+    //! Error message of the last failed parse()
+    const string& getError() const { return error_; }
+
+private:
+    //! Parse a value at pos_, storing array elements in elements_
+    bool parseValue(Member& member);
+
+    //! Parse a string at pos_, which must point at the opening quote
+    bool parseString(JsonToken& token);
+
+    //! Parse a number or literal at pos_
+    bool parseScalar(JsonToken& token);
+
+    //! Skip a nested object or array at pos_
+    bool skipNested();
+
+    //! Skip whitespace at pos_
+    void skipWhitespace();
+
+    //! Record an error at pos_
+    bool fail(const char* message);
+
+    //! Data being parsed
+    const char* begin_;
+    const char* end_;
+    const char* pos_;
+
+    //! Members in the order of the data
+    vector<Member> members_;
+
+    //! Elements of all arrays
+    vector<JsonToken> elements_;
+
+    //! Error message of the last failed parse()
+    string error_;
+};
+
+}
+
+#endif // JSON_READER_H
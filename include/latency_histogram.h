@@ -0,0 +1,76 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+using namespace std;
+
+namespace pepperl_fuchs {
+
+//! \struct LatencyHistogram
+//! \brief Snapshot of a histogram of durations in nanoseconds
+//! Buckets are spaced logarithmically with SUB_BUCKETS linear buckets per power of two,
+//! so a bucket spans at most 25% of its lower bound. Values below SUB_BUCKETS get a bucket each.
+struct LatencyHistogram
+{
+    //! Number of buckets per power of two
+    static const size_t SUB_BUCKETS = 4;
+
+    //! Total number of buckets, covers the whole 64 bit range
+    static const size_t NUM_BUCKETS = 64*SUB_BUCKETS;
+
+    LatencyHistogram() : count(0), sum_ns(0), max_ns(0) { counts.fill(0); }
+
+    //! Number of recorded values per bucket
+    array<uint64_t,NUM_BUCKETS> counts;
+
+    //! Number of recorded values
+    uint64_t count;
+
+    //! Sum of all recorded values
+    uint64_t sum_ns;
+
+    //! Largest recorded value
+    uint64_t max_ns;
+
+    //! Bucket a value is counted in
+    static size_t bucketIndex(uint64_t ns);
+
+    //! Smallest value counted in a bucket
+    static uint64_t bucketLowerBound(size_t index);
+
+    //! Mean of all recorded values, 0 if empty
+    double mean() const { return count ? double(sum_ns)/count : 0.0; }
+
+    //! Estimate a percentile from the buckets
+    //! @param fraction Fraction of values at or below the result, e.g. 0.99
+    //! @returns Upper bound of the bucket containing the percentile (at most max_ns), 0 if empty
+    uint64_t percentile(double fraction) const;
+};
+
+//! \class AtomicHistogram
+//! \brief Lock-free recorder of a LatencyHistogram
+//! Values may be recorded by any thread, a snapshot can be taken concurrently. Counts of a snapshot
+//! taken while values are recorded may be off by the values in flight.
+class AtomicHistogram
+{
+public:
+    AtomicHistogram();
+
+    //! Record a duration, negative durations are counted as zero
+    void record(int64_t ns);
+
+    //! Take a snapshot of the current counts
+    LatencyHistogram snapshot() const;
+
+private:
+    array< atomic<uint64_t>, LatencyHistogram::NUM_BUCKETS > counts_;
+    atomic<uint64_t> count_;
+    atomic<uint64_t> sum_ns_;
+    atomic<uint64_t> max_ns_;
+};
+
+}
+
+#endif // LATENCY_HISTOGRAM_H
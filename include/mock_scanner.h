@@ -0,0 +1,260 @@
+#ifndef MOCK_SCANNER_H
+#define MOCK_SCANNER_H
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <random>
+#include <cstdint>
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+using namespace std;
+
+namespace pepperl_fuchs {
+
+//! \struct MockScannerOptions
+//! \brief Behaviour of a MockScanner
+struct MockScannerOptions
+{
+    MockScannerOptions() : address("127.0.0.1"), http_port(0), scan_frequency(50000), samples_per_scan(3600),
+        points_per_packet(0), packet_loss(0.0), packet_reorder(0.0), packet_corruption(0.0), seed(1) {}
+
+    //! Local address the HTTP interface listens on and UDP data is sent from
+    string address;
+
+    //! HTTP port, 0 to choose a free port, see MockScanner::getHttpPort()
+    int http_port;
+
+    //! Rotation rate in mHz, may exceed the 50 Hz of real hardware
+    //! Changed at run time by setting the scan_frequency parameter (in Hz)
+    unsigned int scan_frequency;
+
+    //! Number of points per scan, may exceed the 25200 of real hardware up to the 65535 the packet header can count
+    //! Changed at run time by setting the samples_per_scan parameter
+    unsigned int samples_per_scan;
+
+    //! Points per packet, 0 for the maximum fitting into a packet of 1404 bytes
+    unsigned int points_per_packet;
+
+    //! Probability in [0,1] of a packet not being sent
+    double packet_loss;
+
+    //! Probability in [0,1] of a packet being sent after its successor
+    double packet_reorder;
+
+    //! Probability in [0,1] of a random byte of a packet being overwritten
+    double packet_corruption;
+
+    //! Seed of the random generator deciding on loss, reordering and corruption
+    unsigned int seed;
+};
+
+//! \struct MockScannerStats
+//! \brief Counters of a MockScanner
+struct MockScannerStats
+{
+    //! Number of HTTP requests answered
+    uint64_t requests;
+
+    //! Number of packets sent, including reordered and corrupted ones
+    uint64_t packets_sent;
+
+    //! Number of packets dropped on purpose
+    uint64_t packets_lost;
+
+    //! Number of packets sent after their successor
+    uint64_t packets_reordered;
+
+    //! Number of packets sent with a corrupted byte
+    uint64_t packets_corrupted;
+
+    //! Number of handles whose watchdog expired
+    uint64_t watchdog_timeouts;
+};
+
+//! \class MockScanner
+//! \brief Emulates a R2000 on the local host for tests and benchmarks without hardware
+//! Serves the pfsdp HTTP/JSON commands used by CommandInterface (with HTTP/1.1 keep-alive and
+//! pipelining) and sends type C UDP packets as described in packet_structure.h for every handle
+//! with started scan output. Distances describe a fixed synthetic scene. Only UDP handles are
+//! supported. HTTP is served on an own IO thread, packets are sent by a separate thread paced by
+//! the rotation rate, so rates far beyond real hardware are possible.
+class MockScanner
+{
+public:
+    //! Start serving on the configured address
+    //! @param options Rotation, packet and fault injection settings
+    MockScanner(const MockScannerOptions& options = MockScannerOptions());
+
+    //! Stop sending and close all connections
+    ~MockScanner();
+
+    //! Check if the HTTP interface could be opened
+    bool isRunning() const { return is_running_; }
+
+    //! Get the address to connect to
+    const string& getAddress() const { return options_.address; }
+
+    //! Get the port of the HTTP interface
+    int getHttpPort() const { return http_port_; }
+
+    //! Change the fault injection probabilities at run time
+    void setFaults(double packet_loss, double packet_reorder, double packet_corruption);
+
+    //! Get a snapshot of the counters
+    MockScannerStats getStats() const;
+
+private:
+    //! \struct Handle
+    //! \brief State of a handle requested by a client
+    struct Handle
+    {
+        //! Destination of the scan data
+        boost::asio::ip::udp::endpoint endpoint;
+
+        //! Angle of the first point of a scan in 1/10000°
+        int start_angle;
+
+        //! Watchdog settings and host time (CLOCK_MONOTONIC, nanoseconds) of the last command for the handle
+        bool watchdog_enabled;
+        int64_t watchdog_timeout_ns;
+        int64_t last_feed_time;
+
+        //! True while scan output is started
+        bool scan_output;
+
+        //! Packet held back to be sent after its successor, empty if none
+        vector<char> held_packet;
+    };
+
+    //! \struct HttpResponse
+    //! \brief Status code and JSON body of a command
+    struct HttpResponse
+    {
+        int status;
+        string body;
+    };
+
+    //! pfsdp error codes
+    static const int ERROR_SUCCESS = 0;
+    static const int ERROR_UNKNOWN_ARGUMENT = 100;
+    static const int ERROR_UNKNOWN_PARAMETER = 110;
+    static const int ERROR_INVALID_HANDLE = 120;
+    static const int ERROR_ARGUMENT_MISSING = 130;
+    static const int ERROR_INVALID_VALUE = 200;
+    static const int ERROR_OUT_OF_RANGE = 210;
+    static const int ERROR_READ_ONLY = 220;
+
+    //! Maximum number of points of a type C packet of 1404 bytes
+    static const unsigned int MAX_POINTS_PER_PACKET = 336;
+
+    //! Maximum sleep of the sender thread, in milliseconds
+    static const int SENDER_INTERVAL_MS = 1;
+
+    //! Accept the next HTTP connection
+    void startAccept();
+
+    //! Serve a HTTP connection until the client closes it
+    void serveConnection(shared_ptr<boost::asio::ip::tcp::socket> socket, shared_ptr<boost::asio::streambuf> buffer);
+
+    //! Execute a command
+    //! @param target Request target, e.g. "/cmd/get_parameter?list=scan_frequency"
+    HttpResponse handleCommand(const string& target);
+
+    //! Build a JSON response with the given error code and additional members
+    static string jsonResponse(int error_code, const string& members = string());
+
+    //! Quote and escape a string for JSON
+    static string jsonString(const string& value);
+
+    //! Value of a parameter as JSON, empty if unknown (params_mutex_ must be locked)
+    string parameterValue(const string& name) const;
+
+    //! Body of the sender thread
+    void senderLoop();
+
+    //! Build and send the next packet of the rotation to all handles with scan output
+    //! @param measure_time Host time (CLOCK_MONOTONIC, nanoseconds) the first point has been measured at
+    void sendPacket(int64_t measure_time);
+
+    //! Release handles whose watchdog has not been fed in time
+    void checkWatchdogs(int64_t now);
+
+    //! Send a packet, applying loss, reordering and corruption
+    void sendWithFaults(Handle& handle);
+
+    //! Compute the points of the synthetic scene for the given number of samples per scan
+    void buildScene(unsigned int samples);
+
+    //! Random number in [0,1)
+    double random();
+
+    //! Settings
+    const MockScannerOptions options_;
+
+    //! Fault probabilities, changed by setFaults()
+    atomic<double> packet_loss_;
+    atomic<double> packet_reorder_;
+    atomic<double> packet_corruption_;
+
+    //! HTTP port actually listened on
+    int http_port_;
+
+    //! True if the HTTP interface could be opened
+    bool is_running_;
+
+    //! IO service serving HTTP
+    boost::asio::io_service io_service_;
+    boost::asio::ip::tcp::acceptor acceptor_;
+    boost::thread io_service_thread_;
+
+    //! Socket sending UDP data, used by the sender thread only
+    boost::asio::ip::udp::socket udp_socket_;
+
+    //! Handles and parameters, shared between HTTP and sender thread
+    mutable mutex params_mutex_;
+    map< string, Handle > handles_;
+    map< string, string > user_parameters_;
+    unsigned int next_handle_;
+
+    //! Rotation state, scan_frequency_ and samples_per_scan_ can be changed via HTTP
+    atomic<unsigned int> scan_frequency_;
+    atomic<unsigned int> samples_per_scan_;
+
+    //! Time (CLOCK_MONOTONIC, nanoseconds) the scanner has been started at, timestamps count from here
+    int64_t start_time_;
+
+    //! Random generator for fault injection, used by the sender thread only
+    mt19937 random_;
+
+    //! Scan and packet being sent, and number of samples of that scan (sender thread only)
+    uint16_t scan_number_;
+    unsigned int packet_number_;
+    unsigned int scan_samples_;
+
+    //! Packed distance and amplitude of every point of a scan, starting at angle 0 (sender thread only)
+    vector<uint32_t> scene_;
+
+    //! Buffer of the packet being built (sender thread only)
+    vector<char> packet_;
+
+    //! True while the sender thread should keep running
+    atomic<bool> running_;
+
+    //! Background thread sending the packets
+    thread sender_thread_;
+
+    //! Counters
+    atomic<uint64_t> stat_requests_;
+    atomic<uint64_t> stat_packets_sent_;
+    atomic<uint64_t> stat_packets_lost_;
+    atomic<uint64_t> stat_packets_reordered_;
+    atomic<uint64_t> stat_packets_corrupted_;
+    atomic<uint64_t> stat_watchdog_timeouts_;
+};
+
+}
+
+#endif // MOCK_SCANNER_H
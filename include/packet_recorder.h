@@ -0,0 +1,193 @@
+#ifndef PACKET_RECORDER_H
+#define PACKET_RECORDER_H
+#include <string>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <cstdint>
+using namespace std;
+
+namespace pepperl_fuchs {
+
+//! Magic bytes at the start of a capture file ("PFRC" in little endian)
+const uint32_t CAPTURE_FILE_MAGIC = 0x43524650;
+
+//! Version of the capture file format
+const uint16_t CAPTURE_FILE_VERSION = 1;
+
+//! Maximum number of data bytes of a record, the largest datagram or chunk of the TCP stream a DataReceiver reads at once
+const uint32_t CAPTURE_MAX_RECORD_SIZE = 65536;
+
+#pragma pack(1)
+
+//! \struct CaptureFileHeader
+//! \brief Start of a capture file, followed by records without any padding
+struct CaptureFileHeader
+{
+    //! Magic bytes, CAPTURE_FILE_MAGIC
+    uint32_t magic;
+
+    //! File format version, CAPTURE_FILE_VERSION
+    uint16_t version;
+
+    //! Size of this header, records start right after it
+    uint16_t header_size;
+};
+
+//! \struct CaptureRecordHeader
+//! \brief Header of a single record, followed by the data as received
+//! A record holds one UDP datagram, or one chunk of the TCP stream as returned by a single read
+struct CaptureRecordHeader
+{
+    //! Receive time (CLOCK_REALTIME, nanoseconds), taken by the kernel for UDP datagrams
+    int64_t timestamp;
+
+    //! Number of data bytes following this header
+    uint32_t size;
+};
+
+#pragma pack()
+
+//! Path of a capture file within a series of rotated files
+//! @param path Path as given to the PacketRecorder
+//! @param index Index of the file, inserted before the extension
+//! @returns e.g. "scan_0003.pfcap" for "scan.pfcap" and index 3
+string captureFileName(const string& path, uint64_t index);
+
+//! \struct RecorderOptions
+//! \brief Buffering and file rotation settings of a PacketRecorder
+struct RecorderOptions
+{
+    RecorderOptions() : buffer_size(8*1024*1024), max_file_size(0), max_file_duration_s(0) {}
+
+    //! Size of the buffer between IO thread and writer thread in bytes
+    //! Records not fitting into the buffer, because the disk can not keep up, are dropped
+    size_t buffer_size;
+
+    //! Start a new file once the current one would exceed this size in bytes, 0 for no limit
+    uint64_t max_file_size;
+
+    //! Start a new file once the current one has been written for this number of seconds, 0 for no limit
+    unsigned int max_file_duration_s;
+};
+
+//! \struct RecorderStats
+//! \brief Counters of a PacketRecorder
+struct RecorderStats
+{
+    //! Number of records written to disk
+    uint64_t records;
+
+    //! Number of bytes written to disk, including headers
+    uint64_t bytes;
+
+    //! Number of records dropped because the buffer was full
+    uint64_t dropped;
+
+    //! Number of files opened
+    uint64_t files;
+};
+
+//! \class PacketRecorder
+//! \brief Records the raw data received from the scanner into capture files
+//! record() is called by the IO thread and only copies into a lock-free ring buffer, a background
+//! thread drains the buffer with large sequential writes. Records never wrap around the end of the
+//! buffer, so the buffer content is written to the file as it is.
+//! Without rotation, data is written to the given path. With rotation, files are numbered by
+//! inserting the index before the extension, e.g. "scan.pfcap" becomes "scan_0000.pfcap".
+class PacketRecorder
+{
+public:
+    //! Open the first capture file and start the writer thread
+    //! @param path Path of the capture file
+    //! @param options Buffering and file rotation settings
+    PacketRecorder(const string& path, const RecorderOptions& options = RecorderOptions());
+
+    //! Write all buffered records and close the file
+    ~PacketRecorder();
+
+    //! Check if the first capture file could be opened
+    bool isOpen() const { return is_open_; }
+
+    //! Queue a record, must only be called from a single thread
+    //! @param data Data as received
+    //! @param size Number of bytes, at most CAPTURE_MAX_RECORD_SIZE
+    //! @param timestamp Receive time (CLOCK_REALTIME, nanoseconds)
+    //! @returns True if the record has been queued, false if it has been dropped
+    bool record(const char* data, size_t size, int64_t timestamp);
+
+    //! Get a snapshot of the counters
+    RecorderStats getStats() const;
+
+private:
+    //! Size field of a record header telling the writer to continue at the start of the buffer
+    static const uint32_t WRAP_MARKER = 0xFFFFFFFF;
+
+    //! Sleep time of the writer thread if the buffer is empty, in milliseconds
+    static const int WRITER_INTERVAL_MS = 10;
+
+    //! Body of the writer thread
+    void writerLoop();
+
+    //! Write all records buffered so far, rotating files as configured
+    void drain();
+
+    //! Write a range of the buffer to the current file
+    void writeFile(const char* data, size_t size);
+
+    //! Close the current file and open the next one
+    //! @returns True on success, false otherwise
+    bool openFile();
+
+    //! Path as given by the user
+    const string path_;
+
+    //! Buffering and rotation settings
+    const RecorderOptions options_;
+
+    //! Size of the ring buffer in bytes
+    const size_t buffer_size_;
+
+    //! Ring buffer between record() and the writer thread
+    unique_ptr<char[]> buffer_;
+
+    //! Number of bytes ever written into the buffer, written by record() only
+    atomic<uint64_t> head_;
+
+    //! Keeps the producer and writer counters on separate cache lines
+    char head_padding_[64];
+
+    //! Number of bytes ever consumed by the writer thread
+    atomic<uint64_t> tail_;
+
+    //! True if the first capture file could be opened
+    bool is_open_;
+
+    //! Descriptor of the current capture file, -1 if none is open, used by the writer thread only
+    int fd_;
+
+    //! Bytes written to the current file, including its header
+    uint64_t file_size_;
+
+    //! Index of the next file to open
+    uint64_t file_index_;
+
+    //! Host time (CLOCK_MONOTONIC, nanoseconds) the current file has been opened at
+    int64_t file_open_time_;
+
+    //! True while the writer thread should keep running
+    atomic<bool> running_;
+
+    //! Background thread writing the buffer to disk
+    thread writer_thread_;
+
+    //! Counters
+    atomic<uint64_t> stat_records_;
+    atomic<uint64_t> stat_bytes_;
+    atomic<uint64_t> stat_dropped_;
+    atomic<uint64_t> stat_files_;
+};
+
+}
+
+#endif // PACKET_RECORDER_H
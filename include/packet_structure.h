@@ -7,6 +7,12 @@ using namespace std;
 
 namespace pepperl_fuchs {
 
+//! Packet types, selected when requesting a handle
+//! A: distance only, B: distance and amplitude, C: distance and amplitude packed into 32 bit
+const uint16_t PACKET_TYPE_A = 0x0041;
+const uint16_t PACKET_TYPE_B = 0x0042;
+const uint16_t PACKET_TYPE_C = 0x0043;
+
 #pragma pack(1)
 
 struct PacketHeader
@@ -14,7 +20,7 @@ struct PacketHeader
     //! Magic bytes, must be  5C A2 (hex)
     uint16_t magic;
 
-    //! Packet type, must be 43 00 (hex)
+    //! Packet type, 41 00, 42 00 or 43 00 (hex) for type A, B or C
     uint16_t packet_type;
 
     //! Overall packet size (header+payload), 1404 bytes with maximum payload
@@ -67,6 +73,19 @@ struct PacketHeader
 };
 
 
+struct PacketTypeA
+{
+    PacketHeader header;
+    uint32_t distance_payload; // distance 32 bit
+};
+
+struct PacketTypeB
+{
+    PacketHeader header;
+    uint32_t distance_payload; // distance 32 bit
+    uint16_t amplitude_payload; // amplitude 16 bit
+};
+
 struct PacketTypeC
 {
     PacketHeader header;
@@ -76,16 +95,39 @@ struct PacketTypeC
 
 //! \struct ScanData
 //! \brief Normally contains one complete laserscan (a full rotation of the scanner head)
+//! Points are stored at their scan index, i.e. distance_data[i] belongs to point i of the rotation
 struct ScanData
 {
+    ScanData() : complete(false), gap_before(false), host_timestamp(0), receive_timestamp(0) {}
+
     //! Distance data in polar form in millimeter
     vector<uint32_t> distance_data;
 
     //! Amplitude data, values lower than 32 indicate an error or undefined values
+    //! Empty for packet type A, which carries no amplitudes
     vector<uint32_t> amplitude_data;
 
-    //! Header received with the distance and amplitude data
+    //! Validity bitmask, bit i (word i/64, bit i%64) is set if point i holds an echo
+    //! Points without echo or not received have their bit cleared
+    vector<uint64_t> valid_mask;
+
+    //! Header received with the distance and amplitude data, ordered by first_index
     vector<PacketHeader> headers;
+
+    //! True if all packets of the scan have been received
+    //! Ranges of missing packets hold NO_ECHO_DISTANCE, zero amplitude and cleared valid_mask bits
+    bool complete;
+
+    //! True for the first scan after an interruption of the data stream, e.g. after the driver
+    //! restarted the scan output, so scans before this one have been lost
+    bool gap_before;
+
+    //! Host time (CLOCK_MONOTONIC, nanoseconds) the first point of the scan has been measured at,
+    //! mapped from the scanner timestamps
+    int64_t host_timestamp;
+
+    //! Host time (CLOCK_MONOTONIC, nanoseconds) the last received packet of the scan arrived at
+    int64_t receive_timestamp;
 };
 
 }
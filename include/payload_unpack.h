@@ -0,0 +1,151 @@
+#ifndef PAYLOAD_UNPACK_H
+#define PAYLOAD_UNPACK_H
+#include <cstdint>
+#include <cstddef>
+#include <packet_structure.h>
+using namespace std;
+
+namespace pepperl_fuchs {
+
+//! Distance value the scanner reports for a scan point without echo
+//! Packet types A and B report 0xFFFFFFFF instead, which is translated to this value
+const uint32_t NO_ECHO_DISTANCE = 0xFFFFF;
+
+//! Implementations of the payload decoders, the best supported one is selected at runtime
+enum UnpackKernel
+{
+    UNPACK_KERNEL_SCALAR,
+    UNPACK_KERNEL_SSE2,
+    UNPACK_KERNEL_AVX2
+};
+
+//! Check if a kernel has been compiled in and is supported by the CPU
+bool isUnpackKernelSupported(UnpackKernel kernel);
+
+//! Unpack the payload of a type C packet into separate distance and amplitude arrays
+//! Selects an AVX2 or SSE2 kernel at runtime if supported by the CPU, the scalar kernel otherwise
+//! @param src Packed payload words (distance 20 bit, amplitude 12 bit)
+//! @param count Number of payload words
+//! @param distance Destination for count distances
+//! @param amplitude Destination for count amplitudes
+//! @param valid_mask Bitmask to update, bit (first_bit+i) is set if point i has an echo and cleared otherwise
+//! @param first_bit Bit position of the first point within valid_mask
+void unpackPayloadC(const uint32_t* src, size_t count, uint32_t* distance, uint32_t* amplitude,
+                    uint64_t* valid_mask, size_t first_bit);
+
+//! Portable reference implementation of unpackPayloadC()
+void unpackPayloadCScalar(const uint32_t* src, size_t count, uint32_t* distance, uint32_t* amplitude,
+                          uint64_t* valid_mask, size_t first_bit);
+
+//! Unpack the payload of a type C packet with the given kernel instead of the selected one, e.g. for benchmarks
+//! The kernel must be supported, see isUnpackKernelSupported()
+void unpackPayloadC(UnpackKernel kernel, const uint32_t* src, size_t count, uint32_t* distance, uint32_t* amplitude,
+                    uint64_t* valid_mask, size_t first_bit);
+
+//! Unpack the payload of a type A packet (distance only)
+//! Selects an AVX2 or SSE2 kernel at runtime if supported by the CPU, the scalar kernel otherwise
+//! @param src Payload words (distance 32 bit)
+//! @param count Number of payload words
+//! @param distance Destination for count distances, points without echo are set to NO_ECHO_DISTANCE
+//! @param valid_mask Bitmask to update, see unpackPayloadC()
+//! @param first_bit Bit position of the first point within valid_mask
+void unpackPayloadA(const uint32_t* src, size_t count, uint32_t* distance, uint64_t* valid_mask, size_t first_bit);
+
+//! Portable reference implementation of unpackPayloadA()
+void unpackPayloadAScalar(const uint32_t* src, size_t count, uint32_t* distance, uint64_t* valid_mask, size_t first_bit);
+
+//! Unpack the payload of a type A packet with the given kernel instead of the selected one, e.g. for benchmarks
+//! The kernel must be supported, see isUnpackKernelSupported()
+void unpackPayloadA(UnpackKernel kernel, const uint32_t* src, size_t count, uint32_t* distance, uint64_t* valid_mask, size_t first_bit);
+
+//! Unpack the payload of a type B packet (distance 32 bit and amplitude 16 bit per point, 6 bytes)
+//! @param src Packed payload, no alignment required
+//! @param count Number of points
+//! @param distance Destination for count distances, points without echo are set to NO_ECHO_DISTANCE
+//! @param amplitude Destination for count amplitudes
+//! @param valid_mask Bitmask to update, see unpackPayloadC()
+//! @param first_bit Bit position of the first point within valid_mask
+void unpackPayloadB(const char* src, size_t count, uint32_t* distance, uint32_t* amplitude,
+                    uint64_t* valid_mask, size_t first_bit);
+
+//! \struct PacketPayload
+//! \brief Payload layout and decoder of a packet type, specialized for types A, B and C
+//! Lets the parser be instantiated per packet type, so the per packet work has no runtime type checks.
+template<uint16_t PACKET_TYPE>
+struct PacketPayload;
+
+template<>
+struct PacketPayload<PACKET_TYPE_A>
+{
+    //! Size of a single point in bytes
+    static const size_t POINT_SIZE = 4;
+
+    //! True if the packet type carries amplitudes
+    static const bool HAS_AMPLITUDE = false;
+
+    //! Decode count points, amplitude is ignored if the packet type carries no amplitudes
+    static void unpack(const char* src, size_t count, uint32_t* distance, uint32_t*, uint64_t* valid_mask, size_t first_bit)
+    {
+        unpackPayloadA((const uint32_t*) src,count,distance,valid_mask,first_bit);
+    }
+};
+
+template<>
+struct PacketPayload<PACKET_TYPE_B>
+{
+    static const size_t POINT_SIZE = 6;
+    static const bool HAS_AMPLITUDE = true;
+    static void unpack(const char* src, size_t count, uint32_t* distance, uint32_t* amplitude, uint64_t* valid_mask, size_t first_bit)
+    {
+        unpackPayloadB(src,count,distance,amplitude,valid_mask,first_bit);
+    }
+};
+
+template<>
+struct PacketPayload<PACKET_TYPE_C>
+{
+    static const size_t POINT_SIZE = 4;
+    static const bool HAS_AMPLITUDE = true;
+    static void unpack(const char* src, size_t count, uint32_t* distance, uint32_t* amplitude, uint64_t* valid_mask, size_t first_bit)
+    {
+        unpackPayloadC((const uint32_t*) src,count,distance,amplitude,valid_mask,first_bit);
+    }
+};
+
+//! Size of a single point of a packet type in bytes
+//! @returns Point size, 0 for unknown packet types
+inline size_t payloadPointSize(uint16_t packet_type)
+{
+    switch( packet_type )
+    {
+    case PACKET_TYPE_A: return PacketPayload<PACKET_TYPE_A>::POINT_SIZE;
+    case PACKET_TYPE_B: return PacketPayload<PACKET_TYPE_B>::POINT_SIZE;
+    case PACKET_TYPE_C: return PacketPayload<PACKET_TYPE_C>::POINT_SIZE;
+    default: return 0;
+    }
+}
+
+//! Overwrite count (at most 64) bits of a bitmask starting at an arbitrary bit position
+//! @param mask Bitmask
+//! @param pos Position of the first bit to write
+//! @param bits New bit values, bit 0 is written to position pos
+//! @param count Number of bits to write
+inline void writeMaskBits(uint64_t* mask, size_t pos, uint64_t bits, size_t count)
+{
+    if( count == 0 )
+        return;
+    const uint64_t field = (count >= 64) ? ~uint64_t(0) : ((uint64_t(1) << count) - 1);
+    bits &= field;
+    const size_t word = pos / 64;
+    const size_t shift = pos % 64;
+    mask[word] = (mask[word] & ~(field << shift)) | (bits << shift);
+    if( shift + count > 64 )
+    {
+        const size_t done = 64 - shift;
+        mask[word+1] = (mask[word+1] & ~(field >> done)) | (bits >> done);
+    }
+}
+
+}
+
+#endif // PAYLOAD_UNPACK_H
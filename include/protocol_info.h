@@ -28,13 +28,16 @@ struct ProtocolInfo
 struct HandleInfo
 {
     static const int HANDLE_TYPE_UDP = 1;
+    static const int HANDLE_TYPE_TCP = 2;
 
     int handle_type;
 
     //! UDP Handle: IP at client side where scanner data is sent to
+    //! TCP Handle: IP or hostname of the scanner to connect to
     string hostname;
 
     //! UDP port at client side where scanner data is sent to
+    //! TCP port at scanner side to connect to
     int port;
 
     //! Handle ID
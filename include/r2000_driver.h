@@ -5,21 +5,88 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <mutex>
+#include <future>
+#include <condition_variable>
 #include <boost/optional.hpp>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <protocol_info.h>
 #include <packet_structure.h>
+#include <scan_subscription.h>
+#include <receiver_stats.h>
+#include <receiver_options.h>
+#include <packet_recorder.h>
 
 namespace pepperl_fuchs {
 
 class CommandInterface;
 class DataReceiver;
+class CaptureReplay;
+
+//! \struct WatchdogStats
+//! \brief Counters of the background watchdog keeper of a R2000Driver
+struct WatchdogStats
+{
+    //! Number of successful feeds
+    uint64_t feeds;
+
+    //! Number of failed feeds
+    uint64_t failures;
+
+    //! Number of failed feeds since the last successful one
+    unsigned int consecutive_failures;
+
+    //! Number of times the handle has been requested again after repeated failures
+    uint64_t recoveries;
+};
+
+//! State of the data stream as seen by the link monitor of a R2000Driver
+enum LinkState
+{
+    //! Packets arrive at the expected cadence
+    LINK_UP,
+
+    //! Packets stopped arriving, the scan output is being restarted
+    LINK_LOST,
+
+    //! Recovery has been given up, the data receiver has been disconnected and the watchdog is not fed anymore
+    //! The handle is released by stopCapturing() or disconnect()
+    LINK_FAILED
+};
+
+//! \struct LinkStats
+//! \brief State and counters of the link monitor of a R2000Driver
+struct LinkStats
+{
+    //! Current state of the data stream
+    LinkState state;
+
+    //! Number of detected interruptions of the data stream
+    uint64_t losses;
+
+    //! Number of interruptions after which packets arrived again
+    uint64_t recoveries;
+
+    //! Number of attempts to restart the scan output or to request a new handle
+    uint64_t recovery_attempts;
+
+    //! Time between the last packet before and the first packet after the last interruption (nanoseconds),
+    //! resolved to the link check interval
+    int64_t last_downtime_ns;
+};
 
 class R2000Driver
 {
 public:
-    //! Initialize driver
+    //! Initialize driver, data is received on an own IO thread
     R2000Driver();
 
+    //! Initialize driver, data is received and commands are sent on a shared io_service
+    //! Blocking methods of the driver wait for the io_service, so they must not be called from its threads
+    //! @param io_service io_service which must be running until the driver is destroyed
+    R2000Driver(boost::asio::io_service& io_service);
+
     //! Cleanly disconnect in case of destruction
     ~R2000Driver();
 
@@ -28,6 +95,14 @@ public:
     //! @param port Port to use for HTTP-Interface (defaults to 80)
     bool connect(const string hostname, int port=80);
 
+    //! Connect without blocking, protocol info and parameters are requested back to back
+    //! Connecting to several laserscanners at once takes as long as the slowest one. No other method
+    //! of the driver must be called before the future is ready.
+    //! @param hostname IP or hostname of laserscanner
+    //! @param port Port to use for HTTP-Interface (defaults to 80)
+    //! @returns Future which becomes true once connected, false on failure
+    future<bool> connectAsync(const string& hostname, int port=80);
+
     //! Disconnect from the laserscanner and reset internal state
     void disconnect();
 
@@ -42,10 +117,39 @@ public:
     //! @returns True in case of success, False otherwise
     bool startCapturingUDP();
 
+    //! Start replaying capture files written by startRecording(), instead of capturing from a scanner
+    //! Scans are delivered by the same API as captured ones, no connection to a scanner is needed.
+    //! Once the capture has been replayed, getFullScan() returns the remaining scans and then empty ones.
+    //! Use QUEUE_BLOCK_PRODUCER in the receiver options to get every scan at speeds above real time.
+    //! @param path Path of a capture file, or the path given to startRecording() for rotated files
+    //! @param speed Replay speed relative to the recording, e.g. 1.0 for real time, 0 for as fast as possible
+    //! @returns True in case of success, False otherwise
+    bool startReplay( const string& path, double speed = 1.0 );
+
     //! Stop capturing laserdata: Release handle and stop retrieving data from the scanner
+    //! Also stops a replay started by startReplay()
     //! @returns True in case of success, False otherwise
     bool stopCapturing();
 
+    //! Select how upcoming UDP captures read the socket
+    //! @param receive_mode Read one datagram per wakeup or drain the socket in batches
+    void setReceiveMode( ReceiveMode receive_mode ) { receiver_options_.receive_mode = receive_mode; }
+
+    //! Select the packet type requested for upcoming captures
+    //! Type A halves the bandwidth and decoding work if amplitudes are not needed, ScanData::amplitude_data stays empty then
+    //! @param packet_type 'A' (distance), 'B' (distance and amplitude) or 'C' (distance and amplitude packed, default)
+    //! @returns True if the packet type is supported, false otherwise
+    bool setPacketType( char packet_type );
+
+    //! Select socket and IO thread settings for upcoming captures
+    //! A bind_address is also used as destination address of the UDP stream
+    //! @param options Receive mode, socket and IO thread settings
+    void setReceiverOptions( const ReceiverOptions& options ) { receiver_options_ = options; }
+
+    //! Get the socket and IO thread settings in effect for the running capture
+    //! @returns Effective settings, the requested ones if no capture is running
+    ReceiverOptions getEffectiveReceiverOptions() const;
+
     //! Return capture status
     //! @returns True if a capture is running, False otherwise
     bool isCapturing();
@@ -68,9 +172,71 @@ public:
 
     //! Pop a single full scan out of the driver's internal FIFO queue if there is any
     //! If no full scan is available yet, blocks until a full scan is available
+    //! Does not talk to the scanner, the watchdog is fed by a timer on the IO thread while capturing
     //! @returns A ScanData struct with distance and amplitude data as well as the packet headers belonging to the data
     ScanData getFullScan();
 
+    //! Hand a scan obtained by getFullScan() back to the driver, so its buffers can be reused for upcoming scans
+    //! Avoids heap allocations for every received scan. Must be called from the thread calling getFullScan()
+    //! @param scan Scan to recycle, left empty
+    void releaseScan(ScanData&& scan);
+
+    //! Get a snapshot of the counters of the running capture
+    //! @returns Receiver counters, all zero if no capture is running
+    ReceiverStats getReceiverStats() const;
+
+    //! Record the raw data received from the scanner into capture files, until stopRecording() is called
+    //! Applies to the running capture and to captures started later on
+    //! @param path Path of the capture file
+    //! @param options Buffering and file rotation settings
+    //! @returns True if the capture file could be opened, false otherwise
+    bool startRecording( const string& path, const RecorderOptions& options = RecorderOptions() );
+
+    //! Stop recording, buffered data is written before returning
+    void stopRecording();
+
+    //! Get a snapshot of the counters of the recorder
+    //! @returns Recorder counters, all zero if not recording
+    RecorderStats getRecorderStats() const;
+
+    //! Register a callback, which is called on the IO thread the moment the last packet of a scan arrived
+    //! The callback must return quickly, as no data is received while it runs. While any subscription
+    //! exists, scans are no longer queued for getFullScan(). Subscriptions persist across captures.
+    //! @param callback Function called with a const view of every completed scan, only valid during the call
+    //! @returns Id of the subscription, to be passed to unsubscribeScans()
+    unsigned int subscribeScans( const ScanCallback& callback );
+
+    //! Register a callback, which is posted to the given executor for every completed scan
+    //! The callback receives a copy of the scan, which stays valid during the call on the executor
+    //! @param callback Function called with every completed scan
+    //! @param executor io_service running the callback, must outlive the subscription
+    //! @returns Id of the subscription, to be passed to unsubscribeScans()
+    unsigned int subscribeScans( const ScanCallback& callback, boost::asio::io_service& executor );
+
+    //! Remove a scan subscription
+    //! Waits while a capture is started or stopped, so calling it from a callback on the IO thread may deadlock with stopCapturing()
+    //! @param id Id returned by subscribeScans()
+    void unsubscribeScans( unsigned int id );
+
+    //! Register a callback, which is called on the IO thread for every sector of a fixed number of packets
+    //! as soon as the sector has been received, while full scans are still delivered as usual
+    //! @param callback Function called with a const view of every completed sector, only valid during the call
+    //! @param packets_per_sector Number of packets per sector
+    //! @returns Id of the subscription, to be passed to unsubscribeSectors()
+    unsigned int subscribeSectorsByPackets( const SectorCallback& callback, unsigned int packets_per_sector );
+
+    //! Register a callback, which is called on the IO thread for every sector of a fixed angular width
+    //! as soon as the sector has been received, while full scans are still delivered as usual
+    //! @param callback Function called with a const view of every completed sector, only valid during the call
+    //! @param degrees_per_sector Angular width of a sector in degrees
+    //! @returns Id of the subscription, to be passed to unsubscribeSectors()
+    unsigned int subscribeSectorsByAngle( const SectorCallback& callback, double degrees_per_sector );
+
+    //! Remove a sector subscription
+    //! Waits while a capture is started or stopped, so calling it from a callback on the IO thread may deadlock with stopCapturing()
+    //! @param id Id returned by subscribeSectorsByPackets() or subscribeSectorsByAngle()
+    void unsubscribeSectors( unsigned int id );
+
     //! Set scan frequency (rotation speed of scanner head)
     //! @param frequency Frequency in Hz
     bool setScanFrequency( unsigned int frequency );
@@ -94,15 +260,129 @@ public:
     bool setParameter( const string& name, const string& value );
 
     //! Feed the watchdog with the current handle ID, to keep the data connection alive
-    void feedWatchdog(bool feed_always = false);
+    //! Called by the background watchdog keeper while capturing, so there is no need to call it manually
+    //! @param feed_always Feed even if the last feed is less than the feeding interval ago
+    //! @returns True if the watchdog has been fed or did not need to, false on failure
+    bool feedWatchdog(bool feed_always = false);
+
+    //! Get a snapshot of the counters of the background watchdog keeper
+    WatchdogStats getWatchdogStats() const;
+
+    //! Get a snapshot of the state and counters of the link monitor
+    //! While capturing via UDP, the watchdog timer checks every few milliseconds whether packets
+    //! arrive at the cadence given by scan frequency and packets per scan. After an interruption it
+    //! restarts the scan output, or requests a new handle if the scanner lost the old one.
+    LinkStats getLinkStats() const;
 
 private:
-    //! HTTP/JSON interface of the scanner
-    CommandInterface* command_interface_;
+    //! Number of consecutive failed feeds after which the handle is requested again
+    static const unsigned int WATCHDOG_MAX_FAILURES = 3;
+
+    //! Interval between feeding attempts after a failure, in milliseconds
+    static const int WATCHDOG_RETRY_INTERVAL_MS = 1000;
+
+    //! Interval of the link check by the watchdog timer, in milliseconds
+    static const int LINK_CHECK_INTERVAL_MS = 10;
+
+    //! Minimum time without packets after which the link is considered lost, in milliseconds
+    static const int LINK_LOSS_MIN_TIMEOUT_MS = 30;
+
+    //! Number of missed packet intervals after which the link is considered lost
+    static const int LINK_LOSS_PACKET_INTERVALS = 8;
+
+    //! Time to wait for the first packet after starting the capture, in milliseconds
+    static const int LINK_STARTUP_TIMEOUT_MS = 2000;
+
+    //! Interval between recovery attempts while the link is down, in milliseconds
+    static const int LINK_RETRY_INTERVAL_MS = 250;
+
+    //! Time without packets after which recovery is given up and the receiver disconnected, in milliseconds
+    static const int LINK_GIVE_UP_MS = 30000;
+
+    //! Initialize members
+    //! @param io_service Shared io_service for data receivers and the command interface, or 0
+    void initialize( boost::asio::io_service* io_service );
+
+    //! Clean up after a failed capture start: release the handle if one has been requested and delete the receiver
+    void abortCapture();
+
+    //! Start the timer feeding the watchdog of the current handle on the io_service of the command interface
+    void startWatchdog();
+
+    //! Stop the watchdog timer and wait for its handlers and pending commands
+    //! Must be called before the receiver, the handle or the command interface are replaced
+    void stopWatchdog();
+
+    //! Arm the watchdog timer for the next feed, or the next link check if the link is monitored
+    //! watchdog_mutex_ must be locked
+    void scheduleWatchdog(int64_t now);
+
+    //! Handler of the watchdog timer: check the link, feed at food_timeout_ cadence, retry faster
+    //! after failures and escalate to recoverHandleAsync() after WATCHDOG_MAX_FAILURES
+    //! Commands are issued asynchronously, the handler never waits for them
+    void watchdogTick(const boost::system::error_code& error);
+
+    //! Feed the watchdog of the current handle without waiting, feed_pending_ must have been set
+    void feedWatchdogAsync();
+
+    //! Account for a completed feed and escalate after repeated failures, clears feed_pending_
+    void finishFeed(bool fed);
+
+    //! Link monitor state machine, called by the watchdog timer
+    //! Detects missing packets, marks the gap in the data receiver and restarts the scan output
+    void checkLink();
+
+    //! Restart the scan output of the current handle, or request a new handle if it is gone
+    //! Runs asynchronously, link_command_pending_ must have been set and is cleared on completion
+    void restartScanOutputAsync();
+
+    //! Clear link_command_pending_ once a restart or recovery completed
+    void finishLinkCommand();
+
+    //! Request a new UDP handle for the running receiver and restart the scan output
+    //! A TCP handle can not be replaced, as the scanner closes the stream of an expired handle
+    //! @param handler Called with true on success, false otherwise
+    void recoverHandleAsync( const function<void(bool)>& handler );
+
+    //! Add a scan subscription and pass the new set of subscribers to the data receiver
+    //! @returns Id of the new subscription
+    unsigned int addScanSubscription( const ScanCallback& callback, boost::asio::io_service* executor );
+
+    //! Add a sector subscription and pass the new set of subscribers to the data receiver
+    //! @returns Id of the new subscription
+    unsigned int addSectorSubscription( const SectorCallback& callback, unsigned int packets_per_sector, double degrees_per_sector );
+
+    //! Get the HTTP/JSON interface, which stays valid while in use even if the driver disconnects
+    shared_ptr<CommandInterface> getCommandInterface() const;
+
+    //! HTTP/JSON interface of the scanner, thread-safe by itself
+    shared_ptr<CommandInterface> command_interface_;
+
+    //! Serializes connecting, capturing and disconnecting, and protects the subscriptions
+    //! Commands not changing this state, e.g. reading parameters or feeding the watchdog, run without it
+    mutable recursive_mutex state_mutex_;
+
+    //! Protects command_interface_, handle_info_ and watchdog_feed_time_, never held during a command
+    mutable mutex handle_mutex_;
 
     //! Asynchronous data receiver
     DataReceiver* data_receiver_;
 
+    //! Source injecting into data_receiver_ while replaying, 0 otherwise
+    CaptureReplay* capture_replay_;
+
+    //! Shared io_service for data receivers and the command interface, 0 if each runs its own IO thread
+    boost::asio::io_service* io_service_;
+
+    //! Receive mode, socket and IO thread settings for captures
+    ReceiverOptions receiver_options_;
+
+    //! Packet type requested for captures
+    char packet_type_;
+
+    //! Recorder passed to every new data receiver, 0 if not recording
+    shared_ptr<PacketRecorder> recorder_;
+
     //! Internal connection state
     bool is_connected_;
 
@@ -115,6 +395,51 @@ private:
     //! Feeding interval (in seconds)
     double food_timeout_;
 
+    //! Timer feeding the watchdog while capturing, runs on the io_service of the command interface
+    unique_ptr<boost::asio::steady_timer> watchdog_timer_;
+
+    //! Serializes the handlers of watchdog_timer_ with its cancellation by stopWatchdog()
+    unique_ptr<boost::asio::io_service::strand> watchdog_strand_;
+
+    //! Protects watchdog_running_, watchdog_stats_, link_stats_ and the pending handlers and commands of the watchdog
+    mutable mutex watchdog_mutex_;
+
+    //! Wakes up stopWatchdog() once pending handlers and commands completed
+    condition_variable watchdog_condition_;
+
+    //! True while the watchdog timer should be rearmed
+    bool watchdog_running_;
+
+    //! Number of handlers of the watchdog queued on the io_service
+    unsigned int watchdog_handlers_;
+
+    //! Counters of the watchdog
+    WatchdogStats watchdog_stats_;
+
+    //! True while a feed issued by the watchdog waits for the scanner
+    bool feed_pending_;
+
+    //! True while a restart or recovery issued by the watchdog waits for the scanner
+    bool link_command_pending_;
+
+    //! Host time (CLOCK_MONOTONIC, nanoseconds) of the next feed by the watchdog
+    int64_t next_feed_time_;
+
+    //! True if the watchdog monitors the link, only UDP handles can be restarted
+    bool monitor_link_;
+
+    //! Host time (CLOCK_MONOTONIC, nanoseconds) the watchdog has been started at
+    int64_t capture_start_time_;
+
+    //! Host time of the last packet before the current interruption
+    int64_t link_lost_time_;
+
+    //! Host time of the last recovery attempt, 0 if none since the interruption
+    int64_t link_recovery_time_;
+
+    //! State and counters of the link monitor, protected by watchdog_mutex_
+    LinkStats link_stats_;
+
     //! Handle information about data connection
     boost::optional<HandleInfo> handle_info_;
 
@@ -123,6 +448,15 @@ private:
 
     //! Cached version of all parameter values
     map< string, string > parameters_;
+
+    //! Registered scan subscribers, passed to every new data receiver
+    vector<ScanSubscription> scan_subscriptions_;
+
+    //! Registered sector subscribers, passed to every new data receiver
+    vector<SectorSubscription> sector_subscriptions_;
+
+    //! Id of the next scan or sector subscription
+    unsigned int next_subscription_id_;
 };
 
 }
@@ -0,0 +1,88 @@
+#ifndef RECEIVER_OPTIONS_H
+#define RECEIVER_OPTIONS_H
+#include <string>
+#include <pthread.h>
+#include <receiver_stats.h>
+using namespace std;
+
+namespace pepperl_fuchs {
+
+//! Behaviour of the queue of completed scans waiting for getFullScan(), if the consumer falls behind
+enum QueuePolicy
+{
+    //! Evict the oldest queued scan in favour of the new one
+    QUEUE_DROP_OLDEST,
+
+    //! Discard the new scan, keep the queued ones
+    QUEUE_DROP_NEWEST,
+
+    //! Only keep the most recent scan (mailbox of depth 1), e.g. for renderers
+    QUEUE_KEEP_LATEST,
+
+    //! Stall reception until the consumer made room: the IO thread stops reading the socket, so the kernel
+    //! drops datagrams once its buffer is full. Meant for replays, where the injecting thread waits instead.
+    //! Not available on a shared io_service, where all scanners served by the same IO thread would stall,
+    //! such receivers fall back to QUEUE_DROP_OLDEST
+    QUEUE_BLOCK_PRODUCER
+};
+
+//! \struct ReceiverOptions
+//! \brief Socket and IO thread settings of a DataReceiver
+//! Every value defaults to the system default. Settings which can not be applied are reported on
+//! stderr, the values actually in effect are available from DataReceiver::getEffectiveOptions().
+struct ReceiverOptions
+{
+    explicit ReceiverOptions(ReceiveMode mode = RECEIVE_MODE_ASYNC) : receive_mode(mode), receive_buffer_size(0),
+        busy_poll_us(0), cpu_affinity(-1), realtime_priority(0), udp_port(0), queue_depth(100), queue_policy(QUEUE_DROP_OLDEST) {}
+
+    //! Strategy for reading the UDP socket
+    ReceiveMode receive_mode;
+
+    //! Size of the socket receive buffer (SO_RCVBUF) in bytes, 0 keeps the system default
+    //! Sizes above net.core.rmem_max are requested with SO_RCVBUFFORCE, which needs CAP_NET_ADMIN.
+    //! The effective value is the one reported by the kernel, i.e. twice the requested size.
+    int receive_buffer_size;
+
+    //! Busy polling time of the device queue on receive (SO_BUSY_POLL) in microseconds, 0 to disable
+    int busy_poll_us;
+
+    //! CPU core to pin the IO thread to, -1 to leave it unpinned
+    //! Only applies to receivers running their own IO thread, see ScannerManager for shared ones
+    int cpu_affinity;
+
+    //! SCHED_FIFO priority of the IO thread (1-99), 0 to keep the default scheduler
+    //! Needs CAP_SYS_NICE or an appropriate RLIMIT_RTPRIO, same restriction as cpu_affinity otherwise
+    int realtime_priority;
+
+    //! Network interface to bind the socket to (SO_BINDTODEVICE), e.g. "eth1", empty for any
+    string bind_device;
+
+    //! Local IP address to bind the UDP socket to, empty for any
+    //! Also passed to the scanner as destination address of the UDP stream
+    string bind_address;
+
+    //! Local UDP port to bind to, 0 for an ephemeral port
+    int udp_port;
+
+    //! Maximum number of completed scans waiting for getFullScan(), forced to 1 for QUEUE_KEEP_LATEST
+    unsigned int queue_depth;
+
+    //! What to do with completed scans if the queue is full
+    QueuePolicy queue_policy;
+};
+
+//! Pin a thread to a CPU core
+//! @param thread Native handle of the thread
+//! @param cpu Index of the CPU core
+//! @returns True on success, false otherwise
+bool setThreadAffinity(pthread_t thread, int cpu);
+
+//! Switch a thread to the SCHED_FIFO real-time scheduler
+//! @param thread Native handle of the thread
+//! @param priority SCHED_FIFO priority (1-99)
+//! @returns True on success, false otherwise
+bool setThreadRealtimePriority(pthread_t thread, int priority);
+
+}
+
+#endif // RECEIVER_OPTIONS_H
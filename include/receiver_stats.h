@@ -0,0 +1,95 @@
+#ifndef RECEIVER_STATS_H
+#define RECEIVER_STATS_H
+#include <cstdint>
+#include <latency_histogram.h>
+using namespace std;
+
+namespace pepperl_fuchs {
+
+//! Strategy used by the DataReceiver to read datagrams from its UDP socket
+enum ReceiveMode
+{
+    //! One asynchronous receive (one syscall and handler dispatch) per datagram
+    RECEIVE_MODE_ASYNC,
+
+    //! Drain all pending datagrams per wakeup with recvmmsg() and parse them as a batch
+    RECEIVE_MODE_BATCH,
+
+    //! No socket, data is passed in with DataReceiver::injectData(), e.g. by a CaptureReplay
+    RECEIVE_MODE_INJECT
+};
+
+//! \struct ReceiverStats
+//! \brief Snapshot of the counters of a DataReceiver
+struct ReceiverStats
+{
+    //! Receive mode the receiver has been constructed with
+    ReceiveMode receive_mode;
+
+    //! Number of datagrams read from the socket (UDP only)
+    uint64_t datagrams;
+
+    //! Number of datagrams discarded because they did not fit into a receive slot (UDP only, not counted in datagrams)
+    uint64_t datagrams_truncated;
+
+    //! Number of datagrams dropped because they held anything else than complete packets (UDP only)
+    uint64_t datagrams_invalid;
+
+    //! Number of socket wakeups (read completions), each delivering one or more datagrams
+    uint64_t wakeups;
+
+    //! Number of bytes read from the socket
+    uint64_t bytes;
+
+    //! Number of valid packets parsed, including duplicates and late packets
+    uint64_t packets;
+
+    //! Number of scans handed over with all of their packets
+    uint64_t scans_completed;
+
+    //! Number of scans handed over with missing packets
+    uint64_t scans_incomplete;
+
+    //! Number of scans dropped because the consumer queue was full, either the new or the oldest ones
+    //! depending on the queue policy
+    uint64_t scans_dropped;
+
+    //! Number of times the IO thread had to wait for the consumer (QUEUE_BLOCK_PRODUCER only)
+    uint64_t producer_blocks;
+
+    //! Largest number of scans waiting in the consumer queue
+    uint64_t queue_high_water;
+
+    //! Number of times data had to be skipped to find the next packet start
+    uint64_t resyncs;
+
+    //! Number of bytes skipped while resyncing
+    uint64_t skipped_bytes;
+
+    //! Number of datagrams dropped by the kernel because the socket receive buffer was full (UDP only)
+    uint64_t kernel_drops;
+
+    //! Offset of host CLOCK_MONOTONIC relative to the scanner clock in nanoseconds, estimated by the clock model
+    int64_t clock_offset_ns;
+
+    //! Rate of the host clock relative to the scanner clock minus one, in parts per million
+    double clock_drift_ppm;
+
+    //! Time from the kernel receiving the last datagram until it has been parsed, in nanoseconds (UDP only)
+    int64_t stack_latency_ns;
+
+    //! Receive time of the last packet minus its timestamp mapped to host time, in nanoseconds
+    //! This is the transfer latency in excess of the minimum latency included in the clock offset
+    int64_t transfer_latency_ns;
+
+    //! Time spent parsing a datagram or a chunk of the TCP stream, including the hand-over of completed scans
+    LatencyHistogram parse_time;
+
+    //! Time from receiving the last packet of a scan until the scan is handed to the consumer,
+    //! i.e. getFullScan() returns it or the scan subscribers are called
+    LatencyHistogram delivery_latency;
+};
+
+}
+
+#endif // RECEIVER_STATS_H
@@ -0,0 +1,82 @@
+#ifndef SCAN_SUBSCRIPTION_H
+#define SCAN_SUBSCRIPTION_H
+#include <functional>
+#include <boost/asio/io_service.hpp>
+#include <packet_structure.h>
+using namespace std;
+
+namespace pepperl_fuchs {
+
+//! Function called for every completed scan
+//! The scan is only valid for the duration of the call and must not be modified
+typedef function<void(const ScanData&)> ScanCallback;
+
+//! \struct ScanSubscription
+//! \brief A registered consumer of completed scans
+struct ScanSubscription
+{
+    //! Id returned on subscription, used to unsubscribe
+    unsigned int id;
+
+    //! Function to call with every completed scan
+    ScanCallback callback;
+
+    //! Executor the callback is posted to, or 0 to call it directly on the IO thread
+    boost::asio::io_service* executor;
+};
+
+//! \struct ScanSector
+//! \brief Angular section of a scan, handed out as soon as all of its points have been received
+//! Every sector is handed out once, in the order its packets complete. Sectors with lost packets are handed
+//! out when their scan is handed over, with the missing points marked invalid in ScanData::valid_mask
+struct ScanSector
+{
+    //! Scan the sector belongs to, possibly still being assembled
+    //! Only the points [first_index, first_index+num_points) are final, valid during the callback only
+    const ScanData* scan;
+
+    //! Sequence number of the scan the sector belongs to
+    uint16_t scan_number;
+
+    //! Index of the first point of the sector within the scan
+    uint32_t first_index;
+
+    //! Number of points within the sector
+    uint32_t num_points;
+
+    //! Absolute angle of the first point of the sector in 1/10000°
+    int32_t first_angle;
+
+    //! Delta between two succeding points in 1/10000°
+    int32_t angular_increment;
+
+    //! Raw timestamp (NTP format) of the packet containing the first point of the sector
+    uint64_t timestamp_raw;
+
+    //! Host time (CLOCK_MONOTONIC, nanoseconds) the first point of the sector has been measured at
+    int64_t host_timestamp;
+};
+
+//! Function called on the IO thread for every completed sector
+typedef function<void(const ScanSector&)> SectorCallback;
+
+//! \struct SectorSubscription
+//! \brief A registered consumer of scan sectors
+struct SectorSubscription
+{
+    //! Id returned on subscription, used to unsubscribe
+    unsigned int id;
+
+    //! Function to call with every completed sector
+    SectorCallback callback;
+
+    //! Sector size in packets, 0 if the sector size is given in degrees
+    unsigned int packets_per_sector;
+
+    //! Sector size in degrees, used if packets_per_sector is 0
+    double degrees_per_sector;
+};
+
+}
+
+#endif // SCAN_SUBSCRIPTION_H
@@ -0,0 +1,105 @@
+#ifndef SCANNER_CLOCK_H
+#define SCANNER_CLOCK_H
+#include <cstdint>
+#include <deque>
+#include <ctime>
+using namespace std;
+
+namespace pepperl_fuchs {
+
+//! Current host time of CLOCK_MONOTONIC in nanoseconds
+inline int64_t monotonicNanoseconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return int64_t(ts.tv_sec)*1000000000 + ts.tv_nsec;
+}
+
+//! Convert a raw timestamp of the scanner (NTP format, 32 bit seconds and 32 bit fraction) to nanoseconds
+inline uint64_t ntpToNanoseconds(uint64_t timestamp_raw)
+{
+    return (timestamp_raw >> 32)*1000000000ull + (((timestamp_raw & 0xFFFFFFFFull)*1000000000ull) >> 32);
+}
+
+//! \class ScannerClock
+//! \brief Running linear model mapping the scanner clock (timestamp_raw) to host CLOCK_MONOTONIC
+//!
+//! Every received packet yields a sample of (scanner time, host receive time). The receive time
+//! is the send time plus a varying network and stack latency, so the model follows the lower
+//! envelope: per window of scanner time only the sample with the smallest latency is kept, and
+//! offset and drift are fitted to the minima of the last windows by least squares. Mapped times
+//! therefore include the minimum transfer latency, but none of its jitter.
+class ScannerClock
+{
+public:
+    //! Create an empty model
+    //! @param window_ns Length of a window of scanner time, one minimum sample is kept per window
+    //! @param num_windows Number of windows the fit is based on
+    ScannerClock(int64_t window_ns = 250000000, size_t num_windows = 40);
+
+    //! Add a sample, i.e. a packet timestamp and the host time the packet has been received at
+    //! The model restarts if the scanner clock jumps, e.g. after a reboot or an NTP step
+    //! @param timestamp_raw Raw timestamp of the packet (NTP format)
+    //! @param host_time_ns Receive time of the packet (CLOCK_MONOTONIC, nanoseconds)
+    void addSample(uint64_t timestamp_raw, int64_t host_time_ns);
+
+    //! Map a scanner timestamp to host time
+    //! @param timestamp_raw Raw timestamp (NTP format)
+    //! @returns Host time (CLOCK_MONOTONIC, nanoseconds), 0 if the model has no samples yet
+    int64_t toHostTime(uint64_t timestamp_raw) const;
+
+    //! True once the model holds at least one sample
+    bool isValid() const { return has_fit_; }
+
+    //! Offset between host and scanner clock at the reference point, in nanoseconds
+    int64_t getOffset() const { return fit_host_ - int64_t(fit_scanner_); }
+
+    //! Rate of the host clock relative to the scanner clock minus one, in parts per million
+    //! Negative if the scanner clock runs fast
+    double getDriftPpm() const { return fit_drift_*1e6; }
+
+    //! Forget all samples
+    void reset();
+
+private:
+    //! Sample with the smallest latency within a window
+    struct Sample
+    {
+        //! Scanner time in nanoseconds
+        uint64_t scanner_ns;
+
+        //! Host receive time in nanoseconds
+        int64_t host_ns;
+    };
+
+    //! Fit offset and drift to the window minima
+    void updateFit();
+
+    //! Length of a window of scanner time
+    int64_t window_ns_;
+
+    //! Maximum number of closed windows used for the fit
+    size_t num_windows_;
+
+    //! Minimum of each closed window, oldest first
+    deque<Sample> windows_;
+
+    //! Minimum of the open window
+    Sample current_;
+
+    //! True if current_ holds a sample
+    bool has_current_;
+
+    //! Scanner time the open window started at
+    uint64_t window_start_;
+
+    //! Model: host = fit_host_ + (scanner - fit_scanner_) * (1 + fit_drift_)
+    bool has_fit_;
+    uint64_t fit_scanner_;
+    int64_t fit_host_;
+    double fit_drift_;
+};
+
+}
+
+#endif // SCANNER_CLOCK_H
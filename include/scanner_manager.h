@@ -0,0 +1,90 @@
+#ifndef SCANNER_MANAGER_H
+#define SCANNER_MANAGER_H
+
+#include <vector>
+#include <memory>
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <r2000_driver.h>
+#include <receiver_stats.h>
+#include <receiver_options.h>
+using namespace std;
+
+namespace pepperl_fuchs {
+
+//! Hosts many scanners on a fixed-size pool of IO threads
+//! Every IO thread runs its own io_service, a scanner is bound to exactly one of them, so its
+//! socket handlers never run concurrently. Threads and wakeups scale with the pool size
+//! instead of the number of scanners.
+class ScannerManager
+{
+public:
+    //! Start the IO thread pool
+    //! @param num_threads Number of IO threads, defaults to the number of CPU cores
+    ScannerManager(unsigned int num_threads = 0);
+
+    //! Destroy all scanners and stop the IO thread pool
+    ~ScannerManager();
+
+    //! Add a scanner driver, served by one of the IO threads
+    //! Connect and start capturing via the returned driver as usual
+    //! @param io_thread Index of the IO thread for the scanner, -1 to distribute scanners round robin
+    //! @returns Index of the new scanner
+    size_t addScanner(int io_thread = -1);
+
+    //! Access a scanner driver
+    //! @param index Index returned by addScanner()
+    R2000Driver& getScanner(size_t index) { return *scanners_[index]; }
+
+    //! Number of hosted scanners
+    size_t getNumScanners() const { return scanners_.size(); }
+
+    //! Number of IO threads
+    unsigned int getNumThreads() const { return io_services_.size(); }
+
+    //! Index of the IO thread serving a scanner
+    //! @param index Index returned by addScanner()
+    unsigned int getScannerThread(size_t index) const { return scanner_threads_[index]; }
+
+    //! Pin an IO thread to a CPU core
+    //! @param io_thread Index of the IO thread
+    //! @param cpu Index of the CPU core
+    //! @returns True on success, false otherwise
+    bool setThreadAffinity(unsigned int io_thread, int cpu);
+
+    //! Run an IO thread with the SCHED_FIFO real-time scheduler
+    //! @param io_thread Index of the IO thread
+    //! @param priority SCHED_FIFO priority (1-99)
+    //! @returns True on success, false otherwise
+    bool setThreadPriority(unsigned int io_thread, int priority);
+
+    //! Get a snapshot of the receiver counters of a scanner
+    //! @param index Index returned by addScanner()
+    ReceiverStats getScannerStats(size_t index) const { return scanners_[index]->getReceiverStats(); }
+
+    //! Get a snapshot of the receiver counters of all scanners, ordered by scanner index
+    vector<ReceiverStats> getStats() const;
+
+private:
+    //! One io_service per IO thread
+    vector< shared_ptr<boost::asio::io_service> > io_services_;
+
+    //! Keeps the io_services running while they have no pending handlers
+    vector< shared_ptr<boost::asio::io_service::work> > io_works_;
+
+    //! IO threads, io_threads_[i] runs io_services_[i]
+    vector< shared_ptr<boost::thread> > io_threads_;
+
+    //! Hosted scanner drivers
+    vector< shared_ptr<R2000Driver> > scanners_;
+
+    //! IO thread index of every scanner
+    vector< unsigned int > scanner_threads_;
+
+    //! IO thread for the next round robin assignment
+    unsigned int next_thread_;
+};
+
+}
+
+#endif // SCANNER_MANAGER_H
@@ -0,0 +1,256 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <cstdint>
+#include <algorithm>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+using namespace std;
+
+namespace pepperl_fuchs {
+
+//! \class SpscQueue
+//! \brief Bounded lock-free queue between exactly one producer and one consumer thread
+//!
+//! push() is wait-free and never blocks the producer. A consumer may either poll with pop()
+//! or block in waitPop(), which sleeps on an eventfd. The producer only issues the wakeup
+//! syscall while a consumer is actually sleeping, and vice versa for a producer in waitPush().
+//!
+//! Every slot carries a sequence number telling whether it is free or filled for a certain round,
+//! so slots are claimed by a compare-and-swap on the tail. This lets the producer evict the oldest
+//! element with pushEvict() while the consumer may pop concurrently.
+template<typename T>
+class SpscQueue
+{
+public:
+    //! Create a queue
+    //! @param capacity Maximum number of queued elements
+    explicit SpscQueue(size_t capacity) : capacity_(capacity > 0 ? capacity : 1), num_slots_(capacity_+1),
+        slots_(new Slot[num_slots_]), head_(0), tail_(0), consumer_waiting_(false), producer_waiting_(false)
+    {
+        for( size_t i=0; i<num_slots_; i++ )
+            slots_[i].sequence.store(i,memory_order_relaxed);
+        event_fd_ = eventfd(0,EFD_NONBLOCK);
+        producer_event_fd_ = eventfd(0,EFD_NONBLOCK);
+    }
+
+    ~SpscQueue()
+    {
+        if( event_fd_ >= 0 )
+            close(event_fd_);
+        if( producer_event_fd_ >= 0 )
+            close(producer_event_fd_);
+    }
+
+    //! Maximum number of queued elements
+    size_t capacity() const { return capacity_; }
+
+    //! Current number of queued elements (approximate if called concurrently)
+    size_t size() const
+    {
+        const size_t tail = tail_.load(memory_order_acquire);
+        const size_t head = head_.load(memory_order_acquire);
+        return head > tail ? head - tail : 0;
+    }
+
+    //! Append an element (producer side only)
+    //! @param item Element to move into the queue, left untouched if the queue is full
+    //! @returns True on success, false if the queue is full
+    bool push(T& item)
+    {
+        const size_t head = head_.load(memory_order_relaxed);
+        if( head - tail_.load(memory_order_acquire) >= capacity_ )
+            return false;
+
+        // The slot is free for this round once the element of the previous round has been taken. With a
+        // spare slot that element is older than the one the consumer may be moving out right now, so
+        // this only fails while pushEvict() and the consumer both pop
+        Slot& slot = slots_[head % num_slots_];
+        if( slot.sequence.load(memory_order_acquire) != head )
+            return false;
+        swap(slot.value, item);
+        slot.sequence.store(head+1,memory_order_release);
+        head_.store(head+1,memory_order_release);
+
+        // Pairs with the fence in waitPop(): either the consumer sees the element or we see the flag
+        atomic_thread_fence(memory_order_seq_cst);
+        if( consumer_waiting_.load(memory_order_relaxed) )
+            notifyEvent(event_fd_);
+        return true;
+    }
+
+    //! Append an element, evicting the oldest one if the queue is full (producer side only)
+    //! @param item Element to move into the queue, receives the evicted element if there was one
+    //! @returns True if the oldest element has been evicted, false if there was room
+    bool pushEvict(T& item)
+    {
+        T evicted;
+        bool has_evicted = false;
+        while( !push(item) )
+        {
+            // Either the queue is full, or the consumer still moves the element out of the slot
+            if( head_.load(memory_order_relaxed) - tail_.load(memory_order_acquire) >= capacity_ )
+                has_evicted = pop(evicted) || has_evicted;
+            else
+                this_thread::yield();
+        }
+        if( has_evicted )
+            swap(item, evicted);
+        return has_evicted;
+    }
+
+    //! Append an element, sleep until there is room or the timeout expired (producer side only)
+    //! @param item Element to move into the queue, left untouched if the queue is still full
+    //! @param timeout_ms Maximum time to sleep in milliseconds
+    //! @returns True on success, false on timeout or after notify()
+    bool waitPush(T& item, int timeout_ms)
+    {
+        if( push(item) )
+            return true;
+
+        producer_waiting_.store(true,memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if( !push(item) )
+        {
+            waitEvent(producer_event_fd_,timeout_ms);
+            producer_waiting_.store(false,memory_order_relaxed);
+            return push(item);
+        }
+        producer_waiting_.store(false,memory_order_relaxed);
+        return true;
+    }
+
+    //! Take the oldest element (consumer side, or producer side within pushEvict())
+    //! @param item Receives the element; its previous content is handed to the queue slot
+    //! @returns True if an element has been taken, false if the queue is empty
+    bool pop(T& item)
+    {
+        size_t tail = tail_.load(memory_order_relaxed);
+        Slot* slot;
+        while( true )
+        {
+            slot = &slots_[tail % num_slots_];
+            const size_t sequence = slot->sequence.load(memory_order_acquire);
+            if( sequence == tail+1 )
+            {
+                // Filled for this round, claim it unless the other side was faster
+                if( tail_.compare_exchange_weak(tail,tail+1,memory_order_acq_rel,memory_order_relaxed) )
+                    break;
+            }
+            else if( sequence == tail )
+                return false;
+            else
+                tail = tail_.load(memory_order_relaxed);
+        }
+        swap(item, slot->value);
+        slot->sequence.store(tail+num_slots_,memory_order_release);
+
+        // Pairs with the fence in waitPush()
+        atomic_thread_fence(memory_order_seq_cst);
+        if( producer_waiting_.load(memory_order_relaxed) )
+            notifyEvent(producer_event_fd_);
+        return true;
+    }
+
+    //! Take the oldest element, sleep until one is available or the timeout expired (consumer side only)
+    //! @param item Receives the element
+    //! @param timeout_ms Maximum time to sleep in milliseconds
+    //! @returns True if an element has been taken, false on timeout or after notify()
+    bool waitPop(T& item, int timeout_ms)
+    {
+        if( pop(item) )
+            return true;
+
+        // Announce the sleeping consumer before checking again, so a concurrent push() either
+        // becomes visible here or sees the flag and signals the eventfd
+        consumer_waiting_.store(true,memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if( !pop(item) )
+        {
+            waitEvent(event_fd_,timeout_ms);
+            consumer_waiting_.store(false,memory_order_relaxed);
+            return pop(item);
+        }
+        consumer_waiting_.store(false,memory_order_relaxed);
+        return true;
+    }
+
+    //! Wake up a consumer sleeping in waitPop() and a producer sleeping in waitPush(), e.g. on shutdown
+    void notify()
+    {
+        notifyEvent(event_fd_);
+        notifyEvent(producer_event_fd_);
+    }
+
+private:
+    //! Element storage with the round it is free or filled for
+    //! sequence == n: free for the element number n, sequence == n+1: holds element number n
+    struct Slot
+    {
+        atomic<size_t> sequence;
+        T value;
+    };
+
+    //! Signal an eventfd
+    static void notifyEvent(int fd)
+    {
+        const uint64_t one = 1;
+        if( write(fd,&one,sizeof(one)) < 0 ) {}
+    }
+
+    //! Sleep until an eventfd has been signaled or the timeout expired, and reset it
+    static void waitEvent(int fd, int timeout_ms)
+    {
+        pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        poll(&pfd,1,timeout_ms);
+
+        uint64_t counter;
+        if( read(fd,&counter,sizeof(counter)) < 0 ) {}
+    }
+
+    //! Maximum number of queued elements
+    const size_t capacity_;
+
+    //! Number of slots, one more than the capacity so a push() into a queue which is not full never
+    //! waits for the consumer to finish taking an element; at least two, so the sequence numbers of
+    //! a free and a filled slot differ
+    const size_t num_slots_;
+
+    //! Element storage, indexed by the free running counters modulo the number of slots
+    unique_ptr<Slot[]> slots_;
+
+    //! Number of elements ever pushed, written by the producer only
+    atomic<size_t> head_;
+
+    //! Keeps producer and consumer counters on separate cache lines
+    char head_padding_[64];
+
+    //! Number of elements ever popped, claimed by compare-and-swap
+    atomic<size_t> tail_;
+
+    //! Keeps producer and consumer counters on separate cache lines
+    char tail_padding_[64];
+
+    //! Set while the consumer sleeps in waitPop()
+    atomic<bool> consumer_waiting_;
+
+    //! Set while the producer sleeps in waitPush()
+    atomic<bool> producer_waiting_;
+
+    //! Wakeup channel for a sleeping consumer
+    int event_fd_;
+
+    //! Wakeup channel for a sleeping producer
+    int producer_event_fd_;
+};
+
+}
+
+#endif // SPSC_QUEUE_H
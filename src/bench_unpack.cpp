@@ -0,0 +1,298 @@
+#include <payload_unpack.h>
+#include <data_receiver.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include <cstring>
+using namespace std;
+using namespace pepperl_fuchs;
+
+//! Points per scan and per packet of the benchmark payload, as sent by a R2000 at 25200 samples
+static const size_t POINTS_PER_SCAN = 25200;
+static const size_t POINTS_PER_PACKET = 336;
+
+//! Share of points without echo
+static const double NO_ECHO_RATIO = 0.1;
+
+//! Size of a packet with maximum payload
+static const size_t MAX_PACKET_SIZE = 1404;
+
+//! Rotation rate of the packets fed to the parser, in mHz
+static const uint32_t SCAN_FREQUENCY = 50000;
+
+//-------------------------------------------------------------------------------
+//! Payload words of a scan, distance 20 bit and amplitude 12 bit
+static vector<uint32_t> makePayloadC()
+{
+    mt19937 random(1);
+    uniform_int_distribution<uint32_t> distance(100,30000);
+    uniform_int_distribution<uint32_t> amplitude(32,4095);
+    bernoulli_distribution no_echo(NO_ECHO_RATIO);
+    vector<uint32_t> payload(POINTS_PER_SCAN);
+    for( size_t i=0; i<payload.size(); i++ )
+        payload[i] = (amplitude(random) << 20) | (no_echo(random) ? NO_ECHO_DISTANCE : distance(random));
+    return payload;
+}
+
+//-------------------------------------------------------------------------------
+//! Run a function repeatedly and return the average duration of a call in nanoseconds
+template<class Function>
+static double timeCall(Function function, size_t iterations)
+{
+    // Warm up caches and the branch predictor
+    for( size_t i=0; i<iterations/10+1; i++ )
+        function();
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for( size_t i=0; i<iterations; i++ )
+        function();
+    const chrono::steady_clock::time_point end = chrono::steady_clock::now();
+    return chrono::duration<double,nano>(end-start).count() / iterations;
+}
+
+//-------------------------------------------------------------------------------
+//! Print a result line, time per scan and per point
+static void report(const string& name, double scan_ns)
+{
+    cout << "  " << left << setw(34) << name << right << fixed
+         << setw(10) << setprecision(2) << scan_ns/1000.0 << " us/scan"
+         << setw(10) << setprecision(3) << scan_ns/POINTS_PER_SCAN << " ns/point" << endl;
+}
+
+//-------------------------------------------------------------------------------
+//! Packet loop as used before unpackPayloadC(), appending every point to the scan vectors
+static void unpackPushBack(const vector<uint32_t>& payload, vector<uint32_t>& distance_data, vector<uint32_t>& amplitude_data)
+{
+    distance_data.clear();
+    amplitude_data.clear();
+    for( size_t first=0; first<payload.size(); first+=POINTS_PER_PACKET )
+    {
+        const uint32_t* p_scan_data = &payload[first];
+        int num_scan_points = min(POINTS_PER_PACKET,payload.size()-first);
+
+        for( int i=0; i<num_scan_points; i++ )
+        {
+            unsigned int word = p_scan_data[i];
+            unsigned int distance = (word & 0x000FFFFF);
+            unsigned int amplitude = (word & 0xFFFFF000) >> 20;
+
+            distance_data.push_back(distance);
+            amplitude_data.push_back(amplitude);
+        }
+    }
+}
+
+//-------------------------------------------------------------------------------
+//! Separate pass a consumer of the push_back loop needs to obtain the validity bitmask
+static void buildValidMask(const vector<uint32_t>& distance_data, vector<uint64_t>& valid_mask)
+{
+    valid_mask.assign((distance_data.size()+63)/64,0);
+    for( size_t i=0; i<distance_data.size(); i++ )
+        valid_mask[i/64] |= uint64_t(distance_data[i] != NO_ECHO_DISTANCE) << (i%64);
+}
+
+//-------------------------------------------------------------------------------
+//! Unpack a scan packet by packet with the given kernel, as DataReceiver does
+static void unpackKernelC(UnpackKernel kernel, const vector<uint32_t>& payload, vector<uint32_t>& distance_data,
+                          vector<uint32_t>& amplitude_data, vector<uint64_t>& valid_mask)
+{
+    for( size_t first=0; first<payload.size(); first+=POINTS_PER_PACKET )
+        unpackPayloadC(kernel,&payload[first],min(POINTS_PER_PACKET,payload.size()-first),
+                       &distance_data[first],&amplitude_data[first],&valid_mask[0],first);
+}
+
+//-------------------------------------------------------------------------------
+//! Benchmark the type C payload decoders: the former push_back loop against the scalar, SSE2 and AVX2 kernels
+static bool benchUnpackC(size_t iterations)
+{
+    cout << "Type C payload, " << POINTS_PER_SCAN << " points per scan in packets of " << POINTS_PER_PACKET << " points:" << endl;
+    const vector<uint32_t> payload = makePayloadC();
+
+    vector<uint32_t> reference_distance, reference_amplitude;
+    vector<uint64_t> reference_mask;
+    reference_distance.reserve(POINTS_PER_SCAN);
+    reference_amplitude.reserve(POINTS_PER_SCAN);
+    report("push_back loop",timeCall([&]() { unpackPushBack(payload,reference_distance,reference_amplitude); },iterations));
+    report("validity mask pass",timeCall([&]() { buildValidMask(reference_distance,reference_mask); },iterations));
+    report("push_back loop + mask pass",timeCall([&]() {
+        unpackPushBack(payload,reference_distance,reference_amplitude);
+        buildValidMask(reference_distance,reference_mask);
+    },iterations));
+
+    const UnpackKernel kernels[] = { UNPACK_KERNEL_SCALAR, UNPACK_KERNEL_SSE2, UNPACK_KERNEL_AVX2 };
+    const char* const kernel_names[] = { "scalar kernel (with mask)", "SSE2 kernel (with mask)", "AVX2 kernel (with mask)" };
+    bool identical = true;
+    for( size_t k=0; k<sizeof(kernels)/sizeof(kernels[0]); k++ )
+    {
+        if( !isUnpackKernelSupported(kernels[k]) )
+        {
+            cout << "  " << kernel_names[k] << ": not supported by this CPU" << endl;
+            continue;
+        }
+        vector<uint32_t> distance(POINTS_PER_SCAN), amplitude(POINTS_PER_SCAN);
+        vector<uint64_t> valid_mask((POINTS_PER_SCAN+63)/64);
+        report(kernel_names[k],timeCall([&]() { unpackKernelC(kernels[k],payload,distance,amplitude,valid_mask); },iterations));
+
+        // Every kernel must reproduce the output of the push_back loop and the mask pass
+        if( distance != reference_distance || amplitude != reference_amplitude || valid_mask != reference_mask )
+        {
+            cout << "  ERROR: " << kernel_names[k] << " output differs from the push_back loop" << endl;
+            identical = false;
+        }
+    }
+    return identical;
+}
+
+//-------------------------------------------------------------------------------
+//! Payload of a scan in the layout of the given packet type, with the same distances and amplitudes as makePayloadC()
+static vector<char> makePayload(uint16_t packet_type)
+{
+    const vector<uint32_t> words = makePayloadC();
+    const size_t point_size = payloadPointSize(packet_type);
+    vector<char> payload(words.size()*point_size);
+    for( size_t i=0; i<words.size(); i++ )
+    {
+        const uint32_t distance = words[i] & 0x000FFFFF;
+        const uint32_t word = ( packet_type == PACKET_TYPE_C ) ? words[i] : ( distance == NO_ECHO_DISTANCE ? 0xFFFFFFFF : distance );
+        const uint16_t amplitude = words[i] >> 20;
+        memcpy(&payload[i*point_size],&word,sizeof(word));
+        if( packet_type == PACKET_TYPE_B )
+            memcpy(&payload[i*point_size+4],&amplitude,sizeof(amplitude));
+    }
+    return payload;
+}
+
+//-------------------------------------------------------------------------------
+//! Number of points fitting into a packet of the given type
+static size_t pointsPerPacket(uint16_t packet_type)
+{
+    return (MAX_PACKET_SIZE - sizeof(PacketHeader)) / payloadPointSize(packet_type);
+}
+
+//-------------------------------------------------------------------------------
+//! Benchmark the type A kernels and the type B decoder on the same scan
+static void benchUnpackAB(size_t iterations)
+{
+    const vector<char> payload_a = makePayload(PACKET_TYPE_A);
+    const size_t points_a = pointsPerPacket(PACKET_TYPE_A);
+    vector<uint32_t> distance(POINTS_PER_SCAN), amplitude(POINTS_PER_SCAN);
+    vector<uint64_t> valid_mask((POINTS_PER_SCAN+63)/64);
+
+    cout << "Type A payload, packets of " << points_a << " points:" << endl;
+    const UnpackKernel kernels[] = { UNPACK_KERNEL_SCALAR, UNPACK_KERNEL_SSE2, UNPACK_KERNEL_AVX2 };
+    const char* const kernel_names[] = { "scalar kernel (with mask)", "SSE2 kernel (with mask)", "AVX2 kernel (with mask)" };
+    for( size_t k=0; k<sizeof(kernels)/sizeof(kernels[0]); k++ )
+    {
+        if( !isUnpackKernelSupported(kernels[k]) )
+        {
+            cout << "  " << kernel_names[k] << ": not supported by this CPU" << endl;
+            continue;
+        }
+        report(kernel_names[k],timeCall([&]() {
+            const uint32_t* src = (const uint32_t*) &payload_a[0];
+            for( size_t first=0; first<POINTS_PER_SCAN; first+=points_a )
+                unpackPayloadA(kernels[k],src+first,min(points_a,POINTS_PER_SCAN-first),&distance[first],&valid_mask[0],first);
+        },iterations));
+    }
+
+    const vector<char> payload_b = makePayload(PACKET_TYPE_B);
+    const size_t points_b = pointsPerPacket(PACKET_TYPE_B);
+    cout << "Type B payload, packets of " << points_b << " points:" << endl;
+    report("scalar decoder (with mask)",timeCall([&]() {
+        for( size_t first=0; first<POINTS_PER_SCAN; first+=points_b )
+            unpackPayloadB(&payload_b[first*6],min(points_b,POINTS_PER_SCAN-first),&distance[first],&amplitude[first],&valid_mask[0],first);
+    },iterations));
+}
+
+//-------------------------------------------------------------------------------
+//! Build the packets of a scan as sent by the scanner
+static vector< vector<char> > makePackets(uint16_t packet_type)
+{
+    const vector<char> payload = makePayload(packet_type);
+    const size_t point_size = payloadPointSize(packet_type);
+    const size_t points_per_packet = pointsPerPacket(packet_type);
+    vector< vector<char> > packets;
+    for( size_t first=0; first<POINTS_PER_SCAN; first+=points_per_packet )
+    {
+        const size_t num_points = min(points_per_packet,POINTS_PER_SCAN-first);
+        PacketHeader header;
+        memset(&header,0,sizeof(header));
+        header.magic = 0xa25c;
+        header.packet_type = packet_type;
+        header.packet_size = sizeof(header) + num_points*point_size;
+        header.header_size = sizeof(header);
+        header.packet_number = packets.size() + 1;
+        header.scan_frequency = SCAN_FREQUENCY;
+        header.num_points_scan = POINTS_PER_SCAN;
+        header.num_points_packet = num_points;
+        header.first_index = first;
+        header.first_angle = -1800000 + int32_t(first*3600000/POINTS_PER_SCAN);
+        header.angular_increment = 3600000/POINTS_PER_SCAN;
+
+        vector<char> packet(header.packet_size);
+        memcpy(&packet[0],&header,sizeof(header));
+        memcpy(&packet[sizeof(header)],&payload[first*point_size],num_points*point_size);
+        packets.push_back(packet);
+    }
+    return packets;
+}
+
+//-------------------------------------------------------------------------------
+//! Feed scans of the given packet type through the parser of a DataReceiver and report the throughput
+//! This covers packet validation, the decoder instantiated for the type and scan assembly up to delivery
+static void benchParser(uint16_t packet_type, const char* name, size_t iterations)
+{
+    vector< vector<char> > packets = makePackets(packet_type);
+    DataReceiver receiver((ReceiverOptions(RECEIVE_MODE_INJECT)));
+    receiver.setDataTimeout(0);
+
+    // Scans are delivered to a subscriber on the injecting thread
+    size_t delivered_points = 0;
+    ScanSubscription subscription;
+    subscription.id = 1;
+    subscription.callback = [&delivered_points](const ScanData& scan) { delivered_points += scan.distance_data.size(); };
+    subscription.executor = 0;
+    receiver.setScanSubscriptions(vector<ScanSubscription>(1,subscription));
+
+    // Scanner and receive times advance by the duration of a packet
+    const int64_t scan_duration_ns = int64_t(1000000000000ll / SCAN_FREQUENCY);
+    const int64_t packet_duration_ns = scan_duration_ns / packets.size();
+    uint16_t scan_number = 0;
+    int64_t time_ns = 1000000000;
+    const double scan_ns = timeCall([&]() {
+        for( size_t i=0; i<packets.size(); i++ )
+        {
+            PacketHeader* header = (PacketHeader*) &packets[i][0];
+            header->scan_number = scan_number;
+            header->timestamp_raw = (uint64_t(time_ns/1000000000) << 32) | (uint64_t(time_ns%1000000000) << 32) / 1000000000;
+            receiver.injectData(&packets[i][0],packets[i].size(),time_ns);
+            time_ns += packet_duration_ns;
+        }
+        scan_number++;
+    },iterations);
+
+    const ReceiverStats stats = receiver.getStats();
+    cout << "  " << left << setw(8) << name << right << fixed
+         << setw(10) << setprecision(2) << scan_ns/1000.0 << " us/scan"
+         << setw(10) << setprecision(1) << POINTS_PER_SCAN/scan_ns*1000.0 << " Mpoints/s"
+         << "  (" << packets.size() << " packets/scan, " << delivered_points/POINTS_PER_SCAN << " scans delivered, "
+         << stats.scans_incomplete << " incomplete)" << endl;
+}
+
+//-------------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    // Number of scans decoded per measurement
+    const size_t iterations = argc > 1 ? max(atoi(argv[1]),1) : 2000;
+
+    const bool identical = benchUnpackC(iterations);
+    benchUnpackAB(iterations);
+
+    cout << "DataReceiver parser, " << POINTS_PER_SCAN << " points per scan:" << endl;
+    benchParser(PACKET_TYPE_A,"type A",iterations);
+    benchParser(PACKET_TYPE_B,"type B",iterations);
+    benchParser(PACKET_TYPE_C,"type C",iterations);
+    return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,126 @@
+#include <capture_replay.h>
+#include <data_receiver.h>
+#include <scanner_clock.h>
+#include <iostream>
+#include <chrono>
+#include <unistd.h>
+using namespace std;
+
+namespace pepperl_fuchs {
+
+//-----------------------------------------------------------------------------
+CaptureReplay::CaptureReplay(const string &path, DataReceiver &receiver, double speed):receiver_(receiver),speed_(max(speed,0.0))
+{
+    first_timestamp_ = 0;
+    start_time_ = 0;
+    replayed_records_ = 0;
+    running_ = false;
+
+    // A single file, or a series of rotated files
+    if( access(path.c_str(),R_OK) == 0 )
+        files_.push_back(path);
+    else
+    {
+        for( uint64_t index=0; access(captureFileName(path,index).c_str(),R_OK) == 0; index++ )
+            files_.push_back(captureFileName(path,index));
+    }
+    if( files_.empty() )
+    {
+        cerr << "ERROR: Could not find capture file " << path << endl;
+        return;
+    }
+
+    running_ = true;
+    replay_thread_ = thread(&CaptureReplay::replayLoop,this);
+}
+
+//-----------------------------------------------------------------------------
+CaptureReplay::~CaptureReplay()
+{
+    stop();
+}
+
+//-----------------------------------------------------------------------------
+void CaptureReplay::stop()
+{
+    running_ = false;
+    if( replay_thread_.joinable() && replay_thread_.get_id() != this_thread::get_id() )
+        replay_thread_.join();
+}
+
+//-----------------------------------------------------------------------------
+void CaptureReplay::replayLoop()
+{
+    for( size_t i=0; i<files_.size() && running_; i++ )
+    {
+        FILE* file = fopen(files_[i].c_str(),"rb");
+        if( !file )
+        {
+            cerr << "ERROR: Could not open capture file " << files_[i] << endl;
+            continue;
+        }
+        setvbuf(file,0,_IOFBF,READ_BUFFER_SIZE);
+        cout << "Replaying capture file " << files_[i] << " ..." << endl;
+        const bool completed = replayFile(file);
+        fclose(file);
+        if( !completed )
+            return;
+    }
+
+    // Let consumers know there is no more data
+    if( running_ )
+        receiver_.disconnect();
+    running_ = false;
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureReplay::replayFile(FILE *file)
+{
+    CaptureFileHeader file_header;
+    if( fread(&file_header,sizeof(file_header),1,file) != 1 || file_header.magic != CAPTURE_FILE_MAGIC
+            || file_header.version != CAPTURE_FILE_VERSION || file_header.header_size < sizeof(file_header) )
+    {
+        cerr << "ERROR: Not a capture file or unsupported version" << endl;
+        return true;
+    }
+    fseek(file,file_header.header_size,SEEK_SET);
+
+    CaptureRecordHeader header;
+    while( running_ && fread(&header,sizeof(header),1,file) == 1 )
+    {
+        // A larger size means the file is corrupted, nothing after it can be trusted
+        if( header.size > CAPTURE_MAX_RECORD_SIZE )
+        {
+            cerr << "ERROR: Capture file contains a record of " << header.size << " bytes, skipping the rest of the file" << endl;
+            break;
+        }
+        record_buffer_.resize(header.size);
+        if( header.size > 0 && fread(&record_buffer_[0],header.size,1,file) != 1 )
+        {
+            cerr << "ERROR: Capture file ends within a record" << endl;
+            break;
+        }
+
+        if( replayed_records_ == 0 )
+        {
+            first_timestamp_ = header.timestamp;
+            start_time_ = monotonicNanoseconds();
+        }
+        const int64_t offset = header.timestamp - first_timestamp_;
+
+        // Pace by the recorded receive times, scaled by the replay speed
+        if( speed_ > 0.0 )
+        {
+            const int64_t delay = start_time_ + int64_t(offset/speed_) - monotonicNanoseconds();
+            if( delay > 0 )
+                this_thread::sleep_for(chrono::nanoseconds(delay));
+        }
+
+        if( header.size > 0 )
+            receiver_.injectData(&record_buffer_[0],header.size,start_time_+offset);
+        replayed_records_.fetch_add(1,memory_order_relaxed);
+    }
+    return running_;
+}
+
+}
@@ -1,119 +1,435 @@
 
 #include <command_interface.h>
 #include <iostream>
-#include <boost/asio.hpp>
-#include <boost/property_tree/json_parser.hpp>
+#include <sstream>
+#include <cstdlib>
+#include <cctype>
+#include <chrono>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 using namespace std;
 
 namespace pepperl_fuchs {
 
 //-----------------------------------------------------------------------------
-CommandInterface::CommandInterface(const string &http_host, int http_port)
+//! Complete a promise from a completion handler
+template<typename T>
+static function<void(T)> fulfill(const shared_ptr< promise<T> >& result)
+{
+    return [result](T value) { result->set_value(value); };
+}
+
+//-----------------------------------------------------------------------------
+CommandInterface::CommandInterface(const string &http_host, int http_port, boost::asio::io_service *io_service):
+    own_io_service_(io_service ? 0 : new boost::asio::io_service()),io_service_(io_service ? *io_service : *own_io_service_),
+    strand_(io_service_)
 {
     http_host_ = http_host;
     http_port_ = http_port;
-    http_status_code_ = 0;
+    max_connections_ = DEFAULT_MAX_CONNECTIONS;
+    shutting_down_ = false;
+    handler_guard_ = make_shared<HandlerGuard>();
+    handler_guard_->command_interface = this;
+    if( own_io_service_ )
+    {
+        io_work_.reset(new boost::asio::io_service::work(io_service_));
+        io_service_thread_ = boost::thread(boost::bind(&boost::asio::io_service::run, &io_service_));
+    }
 }
 
 //-----------------------------------------------------------------------------
-int CommandInterface::httpGet(const string request_path, string &header, string &content)
+CommandInterface::~CommandInterface()
 {
-    header = "";
-    content = "";
-    using boost::asio::ip::tcp;
-    try
+    // Handlers still queued find the interface gone, closing the connections makes their pending
+    // operations complete with operation_aborted. Holding the guard keeps handlers off the strand meanwhile,
+    // connections with pending operations are released by their handlers.
     {
-        boost::asio::io_service io_service;
+        lock_guard<recursive_mutex> lock(handler_guard_->mutex);
+        shutdown();
+        handler_guard_->command_interface = 0;
+        connections_.clear();
+    }
 
-        // Lookup endpoint
-        tcp::resolver resolver(io_service);
-        tcp::resolver::query query(http_host_, to_string(http_port_));
-        tcp::resolver::iterator endpoint_iterator = resolver.resolve(query);
-        tcp::resolver::iterator end;
+    if( own_io_service_ )
+    {
+        io_work_.reset();
+        io_service_.stop();
+        io_service_thread_.join();
+    }
+}
 
-        // Create socket
-        tcp::socket socket(io_service);
-        boost::system::error_code error = boost::asio::error::host_not_found;
+//-----------------------------------------------------------------------------
+void CommandInterface::httpGetAsync(const string &request_path, bool idempotent, const HttpHandler &handler)
+{
+    shared_ptr<HttpRequest> request = make_shared<HttpRequest>();
+    request->data = "GET " + request_path + " HTTP/1.1\r\n"
+                    "Host: " + http_host_ + ":" + to_string(http_port_) + "\r\n"
+                    "Connection: keep-alive\r\n\r\n";
+    request->handler = handler;
+    request->attempts = 0;
+    request->reused = false;
+    request->idempotent = idempotent;
+
+    strand_.post(guarded([this,request]()
+    {
+        if( shutting_down_ )
+            request->handler(0,0,0);
+        else
+        {
+            requests_.push_back(request);
+            startRequests();
+        }
+    }));
+}
 
-        // Iterate over endpoints and etablish connection
-        while (error && endpoint_iterator != end)
+//-----------------------------------------------------------------------------
+void CommandInterface::startRequests()
+{
+    if( shutting_down_ )
+        return;
+
+    // Assign each request to the least loaded connection, opening a new one while none is idle
+    const size_t max_connections = max_connections_;
+    while( !requests_.empty() )
+    {
+        Connection* best = 0;
+        for( size_t i=0; i<connections_.size() && i<max_connections; i++ )
+            if( !best || connections_[i]->requests.size() < best->requests.size() )
+                best = connections_[i].get();
+        if( (!best || !best->requests.empty()) && connections_.size() < max_connections )
         {
-            socket.close();
-            socket.connect(*endpoint_iterator++, error);
+            connections_.push_back(make_shared<Connection>(io_service_));
+            best = connections_.back().get();
         }
-        if (error)
-            throw boost::system::system_error(error);
-
-        // Prepare request
-        boost::asio::streambuf request;
-        ostream request_stream(&request);
-        request_stream << "GET " << request_path << " HTTP/1.0\r\n\r\n";
-
-        boost::asio::write(socket, request);
-
-        // Read the response status line. The response streambuf will automatically
-        // grow to accommodate the entire line. The growth may be limited by passing
-        // a maximum size to the streambuf constructor.
-        boost::asio::streambuf response;
-        boost::asio::read_until(socket, response, "\r\n");
-
-        // Check that response is OK.
-        istream response_stream(&response);
-        string http_version;
-        response_stream >> http_version;
-        unsigned int status_code;
-        response_stream >> status_code;
-        string status_message;
-        getline(response_stream, status_message);
-        if (!response_stream || http_version.substr(0, 5) != "HTTP/")
+        if( best->requests.size() >= MAX_PIPELINED_REQUESTS )
+            break;
+        best->requests.push_back(requests_.front());
+        requests_.pop_front();
+    }
+
+    for( size_t i=0; i<connections_.size(); i++ )
+        startConnection(*connections_[i]);
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::startConnection(Connection &connection)
+{
+    if( connection.requests.empty() || connection.connecting || connection.writing || shutting_down_ )
+        return;
+    if( !connection.socket.is_open() )
+    {
+        startConnect(connection);
+        return;
+    }
+
+    // Write all assigned requests at once
+    if( connection.num_sent >= connection.requests.size() )
+        return;
+    connection.write_buffer.clear();
+    for( size_t i=connection.num_sent; i<connection.requests.size(); i++ )
+    {
+        connection.write_buffer += connection.requests[i]->data;
+        connection.requests[i]->attempts++;
+        connection.requests[i]->reused = ( connection.responses > 0 );
+    }
+    connection.num_sent = connection.requests.size();
+    connection.writing = true;
+    startTimer(connection);
+    boost::asio::async_write(connection.socket, boost::asio::buffer(connection.write_buffer),
+                             strand_.wrap(guarded(boost::bind(&CommandInterface::handleWrite, this, boost::ref(connection), boost::asio::placeholders::error),&connection)));
+    startRead(connection);
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::startConnect(Connection &connection)
+{
+    using boost::asio::ip::tcp;
+
+    // Lookup endpoint once, this blocks the IO thread unless an IP address is given
+    if( endpoints_.empty() )
+    {
+        boost::system::error_code error;
+        tcp::resolver resolver(io_service_);
+        tcp::resolver::query query(http_host_, to_string(http_port_));
+        tcp::resolver::iterator end;
+        for( tcp::resolver::iterator i = resolver.resolve(query,error); !error && i != end; i++ )
+            endpoints_.push_back(*i);
+        if( endpoints_.empty() )
         {
-            cout << "Invalid response\n";
-            return 0;
+            connection.connecting = true;
+            handleConnect(connection, error ? error : boost::asio::error::host_not_found);
+            return;
         }
+    }
+
+    // Iterate over endpoints and etablish connection
+    connection.connecting = true;
+    connection.responses = 0;
+    startTimer(connection);
+    Connection* c = &connection;
+    boost::asio::async_connect(connection.socket, endpoints_.begin(), endpoints_.end(),
+                               strand_.wrap(guarded([this,c](const boost::system::error_code& error, vector<tcp::endpoint>::iterator)
+    {
+        handleConnect(*c,error);
+    },c)));
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::handleConnect(Connection &connection, const boost::system::error_code &error)
+{
+    connection.connecting = false;
+    if( error || shutting_down_ )
+    {
+        // The scanner is not reachable, so the requests waiting for this connection fail
+        if( !shutting_down_ )
+            cerr << "Exception: " << ( connection.timed_out ? string("Connection timed out") : error.message() ) << endl;
+        closeConnection(connection);
+        deque< shared_ptr<HttpRequest> > failed;
+        failed.swap(connection.requests);
+        connection.num_sent = 0;
+        connection.timed_out = false;
+        connection.timer.cancel();
+        failRequests(failed);
+        return;
+    }
+
+    // Requests are small and answered before the next one is sent
+    boost::system::error_code ignored;
+    connection.socket.set_option(boost::asio::ip::tcp::no_delay(true),ignored);
+
+    // The scanner reaches this host at the address the connection comes from
+    const boost::asio::ip::tcp::endpoint local_endpoint = connection.socket.local_endpoint(ignored);
+    if( !ignored )
+        local_address_ = local_endpoint.address().to_string();
+    startConnection(connection);
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::handleWrite(Connection &connection, const boost::system::error_code &error)
+{
+    connection.writing = false;
+    if( error )
+        handleError(connection,error);
+    else
+        startRequests();
+}
 
-        // Read the response headers, which are terminated by a blank line.
-        boost::asio::read_until(socket, response, "\r\n\r\n");
+//-----------------------------------------------------------------------------
+void CommandInterface::startRead(Connection &connection)
+{
+    if( connection.reading || connection.num_sent == 0 || !connection.socket.is_open() )
+        return;
+
+    // Acknowledge at once, a server writing header and content separately would otherwise
+    // wait for the delayed ACK of the header before sending the content
+    int enable = 1;
+    setsockopt(connection.socket.native_handle(), IPPROTO_TCP, TCP_QUICKACK, &enable, sizeof(enable));
+
+    // Read the response status line and headers, which are terminated by a blank line
+    connection.reading = true;
+    boost::asio::async_read_until(connection.socket, connection.response, "\r\n\r\n",
+                                  strand_.wrap(guarded(boost::bind(&CommandInterface::handleReadHeader, this, boost::ref(connection),
+                                                                   boost::asio::placeholders::error,
+                                                                   boost::asio::placeholders::bytes_transferred),&connection)));
+}
 
-        // Process the response headers.
-        string tmp;
-        while (getline(response_stream, tmp) && tmp != "\r")
-            header += tmp+"\n";
+//-----------------------------------------------------------------------------
+void CommandInterface::handleReadHeader(Connection &connection, const boost::system::error_code &error, size_t header_size)
+{
+    if( error )
+    {
+        connection.reading = false;
+        handleError(connection,error);
+        return;
+    }
 
-        // Write whatever content we already have to output.
-        while (getline(response_stream, tmp))
-            content += tmp;
+    // Check that response is OK.
+    const char* data = boost::asio::buffer_cast<const char*>(connection.response.data());
+    istringstream response_stream(string(data,header_size));
+    connection.response.consume(header_size);
+    string http_version;
+    response_stream >> http_version;
+    unsigned int status_code;
+    response_stream >> status_code;
+    string status_message;
+    getline(response_stream, status_message);
+    if (!response_stream || http_version.substr(0, 5) != "HTTP/")
+    {
+        cout << "Invalid response\n";
+        connection.reading = false;
+        handleError(connection,boost::asio::error::invalid_argument);
+        return;
+    }
 
-        // Read until EOF, writing data to output as we go.
-        while (boost::asio::read(socket, response, boost::asio::transfer_at_least(1), error))
+    // Process the response headers
+    connection.response_status = status_code;
+    connection.response_keep_alive = ( http_version != "HTTP/1.0" );
+    connection.response_content_length = 0;
+    connection.response_has_content_length = false;
+    string tmp;
+    while (getline(response_stream, tmp) && tmp != "\r")
+    {
+        const size_t colon = tmp.find(':');
+        if( colon == string::npos )
+            continue;
+        string name = tmp.substr(0,colon);
+        string value = tmp.substr(colon+1);
+        value.erase(0,value.find_first_not_of(' '));
+        value.erase(value.find_last_not_of(" \r")+1);
+        for( size_t i=0; i<name.size(); i++ )
+            name[i] = tolower(name[i]);
+        for( size_t i=0; i<value.size(); i++ )
+            value[i] = tolower(value[i]);
+        if( name == "content-length" )
         {
-            response_stream.clear();
-            while (getline(response_stream, tmp))
-                content += tmp;
+            connection.response_content_length = strtoul(value.c_str(),0,10);
+            connection.response_has_content_length = true;
         }
+        else if( name == "connection" )
+            connection.response_keep_alive = ( value == "keep-alive" || (connection.response_keep_alive && value != "close") );
+    }
+
+    // Without Content-Length the content ends with the connection
+    if( !connection.response_has_content_length )
+    {
+        connection.response_keep_alive = false;
+        boost::asio::async_read(connection.socket, connection.response, boost::asio::transfer_all(),
+                                strand_.wrap(guarded(boost::bind(&CommandInterface::handleReadContent, this, boost::ref(connection), boost::asio::placeholders::error),&connection)));
+    }
+    else if( connection.response.size() < connection.response_content_length )
+        boost::asio::async_read(connection.socket, connection.response, boost::asio::transfer_exactly(connection.response_content_length-connection.response.size()),
+                                strand_.wrap(guarded(boost::bind(&CommandInterface::handleReadContent, this, boost::ref(connection), boost::asio::placeholders::error),&connection)));
+    else
+        handleReadContent(connection,boost::system::error_code());
+}
 
-        if (error != boost::asio::error::eof)
-            throw boost::system::system_error(error);
+//-----------------------------------------------------------------------------
+void CommandInterface::handleReadContent(Connection &connection, const boost::system::error_code &error)
+{
+    connection.reading = false;
+    if( error && !(error == boost::asio::error::eof && !connection.response_has_content_length) )
+    {
+        handleError(connection,error);
+        return;
+    }
 
-        // Substitute CRs by a space
-        for( size_t i=0; i<header.size(); i++ )
-            if( header[i] == '\r' )
-                header[i] = ' ';
+    shared_ptr<HttpRequest> request = connection.requests.front();
+    connection.requests.pop_front();
+    connection.num_sent--;
+    connection.responses++;
+
+    // The content is handed over in place, anything beyond it belongs to the next response
+    const size_t content_length = connection.response_has_content_length ? connection.response_content_length : connection.response.size();
+    const char* data = boost::asio::buffer_cast<const char*>(connection.response.data());
+    request->handler(connection.response_status,data,content_length);
+    connection.response.consume(content_length);
+
+    // The scanner does not answer requests sent after one it closes the connection for,
+    // connections beyond a lowered limit are closed once idle
+    bool beyond_limit = true;
+    for( size_t i=0; i<connections_.size() && i<max_connections_; i++ )
+        beyond_limit = beyond_limit && connections_[i].get() != &connection;
+    if( !connection.response_keep_alive )
+    {
+        closeConnection(connection);
+        connection.num_sent = 0;
+    }
+    else if( beyond_limit && connection.requests.empty() )
+        closeConnection(connection);
+    if( connection.num_sent > 0 )
+        startTimer(connection);
+    else
+        connection.timer.cancel();
 
-        for( size_t i=0; i<content.size(); i++ )
-            if( content[i] == '\r' )
-                content[i] = ' ';
+    startRead(connection);
+    startRequests();
+}
 
-        return status_code;
+//-----------------------------------------------------------------------------
+void CommandInterface::handleError(Connection &connection, const boost::system::error_code &error)
+{
+    if( !connection.socket.is_open() && connection.num_sent == 0 )
+        return;
+    closeConnection(connection);
+
+    // A request which failed on a reused connection is queued once more, as the scanner may just
+    // have closed the idle connection. Timeouts are not retried. A written request may have been
+    // executed already, so only idempotent ones are sent again.
+    deque< shared_ptr<HttpRequest> > failed;
+    deque< shared_ptr<HttpRequest> > retry;
+    for( size_t i=0; i<connection.requests.size(); i++ )
+    {
+        shared_ptr<HttpRequest>& request = connection.requests[i];
+        if( i < connection.num_sent && (connection.timed_out || shutting_down_ || !request->reused || !request->idempotent || request->attempts > 1) )
+            failed.push_back(request);
+        else
+            retry.push_back(request);
     }
-    catch (exception& e)
+    if( !failed.empty() && !shutting_down_ )
+        cerr << "Exception: " << ( connection.timed_out ? string("Request timed out") : error.message() ) << endl;
+    connection.requests.clear();
+    connection.num_sent = 0;
+    connection.timed_out = false;
+    connection.timer.cancel();
+    requests_.insert(requests_.begin(),retry.begin(),retry.end());
+    failRequests(failed);
+    startRequests();
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::startTimer(Connection &connection)
+{
+    connection.timer.expires_from_now(chrono::milliseconds(REQUEST_TIMEOUT_MS));
+    connection.timer.async_wait(strand_.wrap(guarded(boost::bind(&CommandInterface::handleTimeout, this, boost::ref(connection), boost::asio::placeholders::error),&connection)));
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::handleTimeout(Connection &connection, const boost::system::error_code &error)
+{
+    // Closing the socket aborts the pending operations, whose handlers fail the requests
+    if( !error && connection.timer.expires_at() <= chrono::steady_clock::now() && (connection.connecting || connection.num_sent > 0) )
     {
-        cerr << "Exception: " <<  e.what() << endl;
-        return 0;
+        connection.timed_out = true;
+        boost::system::error_code ignored;
+        connection.socket.close(ignored);
     }
 }
 
 //-----------------------------------------------------------------------------
-bool CommandInterface::sendHttpCommand(const string cmd, const map<string, string> param_values)
+void CommandInterface::failRequests(deque< shared_ptr<HttpRequest> > &requests)
+{
+    for( size_t i=0; i<requests.size(); i++ )
+        requests[i]->handler(0,0,0);
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::shutdown()
+{
+    shutting_down_ = true;
+    deque< shared_ptr<HttpRequest> > failed;
+    failed.swap(requests_);
+    for( size_t i=0; i<connections_.size(); i++ )
+    {
+        Connection& connection = *connections_[i];
+        connection.timer.cancel();
+        closeConnection(connection);
+        failed.insert(failed.end(),connection.requests.begin(),connection.requests.end());
+        connection.requests.clear();
+        connection.num_sent = 0;
+    }
+    failRequests(failed);
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::closeConnection(Connection &connection)
+{
+    boost::system::error_code ignored;
+    connection.socket.close(ignored);
+    connection.response.consume(connection.response.size());
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::sendHttpCommand(const string& cmd, const map<string, string>& param_values, const CommandHandler& handler)
 {
     // Build request string
     string request_str = "/cmd/" + cmd + "?";
@@ -122,225 +438,470 @@ bool CommandInterface::sendHttpCommand(const string cmd, const map<string, strin
     if(request_str.back() == '&' )
         request_str = request_str.substr(0,request_str.size()-1);
 
-    // Do HTTP request
-    string header, content;
-    http_status_code_ = httpGet(request_str,header,content);
-
-    // Try to parse JSON response
-    try
+    // Do HTTP request, the response is parsed in place
+    httpGetAsync(request_str,isIdempotentCommand(cmd),[this,handler](int status_code, const char* content, size_t content_length)
     {
-        stringstream ss(content);
-        boost::property_tree::json_parser::read_json(ss,pt_);
-    }
-    catch (exception& e)
-    {
-        cerr << "ERROR: Exception: " <<  e.what() << endl;
-        return false;
-    }
+        if( status_code == 0 )
+        {
+            json_reader_.parse("{}",2); // empty response
+            handler(false,json_reader_);
+            return;
+        }
 
-    // Check HTTP-status code
-    if( http_status_code_ != 200 )
-        return false;
-    else
-        return true;
+        // Try to parse JSON response
+        if( !json_reader_.parse(content,content_length) )
+        {
+            cerr << "ERROR: Invalid JSON response: " << json_reader_.getError() << endl;
+            handler(false,json_reader_);
+            return;
+        }
+
+        // Check HTTP-status code and the error code of the scanner
+        handler(status_code == 200 && checkErrorCode(json_reader_),json_reader_);
+    });
 }
 
 //-----------------------------------------------------------------------------
-bool CommandInterface::sendHttpCommand(const string cmd, const string param, const string value)
+void CommandInterface::sendHttpCommand(const string& cmd, const string& param, const string& value, const CommandHandler& handler)
 {
     map<string, string> param_values;
     if( param != "" )
         param_values[param] = value;
-    return sendHttpCommand(cmd,param_values);
+    sendHttpCommand(cmd,param_values,handler);
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::sendResultCommand(const string &cmd, const string &param, const string &value, const ResultHandler &handler)
+{
+    sendHttpCommand(cmd,param,value,[handler](bool ok, const JsonReader&) { handler(ok); });
+}
+
+//-----------------------------------------------------------------------------
+bool CommandInterface::isIdempotentCommand(const string &cmd)
+{
+    return cmd.compare(0,4,"get_") == 0 || cmd.compare(0,5,"list_") == 0 || cmd == "feed_watchdog";
+}
+
+//-----------------------------------------------------------------------------
+bool CommandInterface::checkErrorCode(const JsonReader& json)
+{
+    // Check the JSON response if error_code == 0 && error_text == success
+    boost::optional<int> error_code = json.getInt("error_code");
+    boost::optional<string> error_text = json.getString("error_text");
+    if( !error_code || (*error_code) != 0 || !error_text || (*error_text) != "success" )
+    {
+        if( error_text )
+            cerr << "ERROR: scanner replied: " << *error_text << endl;
+        return false;
+    }
+    return true;
 }
 
 //-----------------------------------------------------------------------------
 bool CommandInterface::setParameter(const string name, const string value)
 {
-    return sendHttpCommand("set_parameter",name,value) && checkErrorCode();
+    return setParameterAsync(name,value).get();
+}
+
+//-----------------------------------------------------------------------------
+future<bool> CommandInterface::setParameterAsync(const string &name, const string &value)
+{
+    shared_ptr< promise<bool> > result = make_shared< promise<bool> >();
+    setParameterAsync(name,value,fulfill(result));
+    return result->get_future();
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::setParameterAsync(const string &name, const string &value, const ResultHandler &handler)
+{
+    sendResultCommand("set_parameter",name,value,handler);
 }
 
 //-----------------------------------------------------------------------------
 boost::optional< string > CommandInterface::getParameter(const string name)
 {
-    if( !sendHttpCommand("get_parameter","list",name) || ! checkErrorCode()  )
-        return boost::optional<string>();
-    return pt_.get_optional<string>(name);
+    return getParameterAsync(name).get();
+}
+
+//-----------------------------------------------------------------------------
+future< boost::optional<string> > CommandInterface::getParameterAsync(const string &name)
+{
+    shared_ptr< promise< boost::optional<string> > > result = make_shared< promise< boost::optional<string> > >();
+    getParameterAsync(name,fulfill(result));
+    return result->get_future();
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::getParameterAsync(const string &name, const function<void (boost::optional<string>)> &handler)
+{
+    sendHttpCommand("get_parameter","list",name,[name,handler](bool ok, const JsonReader& json)
+    {
+        if( !ok )
+            handler(boost::optional<string>());
+        else
+            handler(json.getString(name));
+    });
 }
 
 //-----------------------------------------------------------------------------
 map< string, string > CommandInterface::getParameters(const vector<string> &names)
+{
+    return getParametersAsync(names).get();
+}
+
+//-----------------------------------------------------------------------------
+future< map< string, string > > CommandInterface::getParametersAsync(const vector<string> &names)
+{
+    shared_ptr< promise< map< string, string > > > result = make_shared< promise< map< string, string > > >();
+    getParametersAsync(names,fulfill(result));
+    return result->get_future();
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::getParametersAsync(const vector<string> &names, const function<void (map<string, string>)> &handler)
 {
     // Build request string
-    map< string, string > key_values;
     string namelist;
     for( const auto& s: names )
         namelist += (s + ";");
     namelist.substr(0,namelist.size()-1);
 
     // Read parameter values via HTTP/JSON request/response
-    if( !sendHttpCommand("get_parameter","list",namelist) || ! checkErrorCode()  )
-        return key_values;
-
-    // Extract values from JSON property_tree
-    for( const auto& s: names )
+    sendHttpCommand("get_parameter","list",namelist,[names,handler](bool ok, const JsonReader& json)
     {
-        auto ov = pt_.get_optional<string>(s);
-        if( ov )
-            key_values[s] = *ov;
-        else
-            key_values[s] = "--COULD NOT RETRIEVE VALUE--";
-    }
+        map< string, string > key_values;
+        if( !ok )
+        {
+            handler(key_values);
+            return;
+        }
 
-    return key_values;
+        // Extract values from JSON, which lists them in the requested order
+        size_t hint = 0;
+        for( const auto& s: names )
+        {
+            const size_t index = json.find(s,hint);
+            string& value = key_values[s];
+            if( index < json.size() && !json.member(index).is_array )
+            {
+                json.member(index).value.appendTo(value);
+                hint = index + 1;
+            }
+            else
+                value = "--COULD NOT RETRIEVE VALUE--";
+        }
+        handler(key_values);
+    });
 }
 
 //-----------------------------------------------------------------------------
-bool CommandInterface::checkErrorCode()
+boost::optional<ProtocolInfo> CommandInterface::getProtocolInfo()
 {
-    // Check the JSON response if error_code == 0 && error_text == success
-    boost::optional<int> error_code = pt_.get_optional<int>("error_code");
-    boost::optional<string> error_text = pt_.get_optional<string>("error_text");
-    if( !error_code || (*error_code) != 0 || !error_text || (*error_text) != "success" )
-    {
-        if( error_text )
-            cerr << "ERROR: scanner replied: " << *error_text << endl;
-        return false;
-    }
-    return true;
+    return getProtocolInfoAsync().get();
 }
 
 //-----------------------------------------------------------------------------
-boost::optional<ProtocolInfo> CommandInterface::getProtocolInfo()
+future< boost::optional<ProtocolInfo> > CommandInterface::getProtocolInfoAsync()
+{
+    shared_ptr< promise< boost::optional<ProtocolInfo> > > result = make_shared< promise< boost::optional<ProtocolInfo> > >();
+    getProtocolInfoAsync(fulfill(result));
+    return result->get_future();
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::getProtocolInfoAsync(const function<void (boost::optional<ProtocolInfo>)> &handler)
 {
     // Read protocol info via HTTP/JSON request/response
-    if( !sendHttpCommand("get_protocol_info") || !checkErrorCode() )
-        return boost::optional<ProtocolInfo>();
-
-    // Read and set protocol info
-    boost::optional<string> protocol_name = pt_.get_optional<string>("protocol_name");
-    boost::optional<int> version_major = pt_.get_optional<int>("version_major");
-    boost::optional<int> version_minor = pt_.get_optional<int>("version_minor");
-    auto ocommands = pt_.get_child_optional("commands");
-    if( !protocol_name || !version_major || !version_minor || !ocommands )
-        return boost::optional<ProtocolInfo>();
-
-    ProtocolInfo pi;
-    pi.protocol_name = *protocol_name;
-    pi.version_major = *version_major;
-    pi.version_minor = *version_minor;
-
-    // Read available commands of the protocol
-    boost::property_tree::ptree commands = *ocommands;
-    for( auto i= commands.begin(); i!=commands.end(); i++ )
+    sendHttpCommand("get_protocol_info","","",[handler](bool ok, const JsonReader& json)
     {
-        string cmd = i->second.get<string>("");
-        pi.commands.push_back(cmd);
-    }
+        if( !ok )
+        {
+            handler(boost::optional<ProtocolInfo>());
+            return;
+        }
 
-    return pi;
+        // Read and set protocol info
+        ProtocolInfo pi;
+        boost::optional<string> protocol_name = json.getString("protocol_name");
+        boost::optional<int> version_major = json.getInt("version_major");
+        boost::optional<int> version_minor = json.getInt("version_minor");
+        if( !protocol_name || !version_major || !version_minor || !json.getStringArray("commands",pi.commands) )
+        {
+            handler(boost::optional<ProtocolInfo>());
+            return;
+        }
+
+        pi.protocol_name = *protocol_name;
+        pi.version_major = *version_major;
+        pi.version_minor = *version_minor;
+        handler(pi);
+    });
 }
 
 //-----------------------------------------------------------------------------
 vector< string > CommandInterface::getParameterList()
+{
+    return getParameterListAsync().get();
+}
+
+//-----------------------------------------------------------------------------
+future< vector< string > > CommandInterface::getParameterListAsync()
+{
+    shared_ptr< promise< vector< string > > > result = make_shared< promise< vector< string > > >();
+    getParameterListAsync(fulfill(result));
+    return result->get_future();
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::getParameterListAsync(const function<void (vector<string>)> &handler)
 {
     // Read available parameters via HTTP/JSON request/response
-    vector< string > parameter_list;
-    if( !sendHttpCommand("list_parameters") || !checkErrorCode() )
-        return parameter_list;
-
-    // Check if JSON contains the key "parameters"
-    auto oparameters = pt_.get_child_optional("parameters");
-    if( !oparameters )
-        return parameter_list;
-
-    // Extract parameter names from JSON
-    boost::property_tree::ptree parameters = *oparameters;
-    for( auto i= parameters.begin(); i!=parameters.end(); i++ )
+    sendHttpCommand("list_parameters","","",[handler](bool ok, const JsonReader& json)
     {
-        string param = i->second.get<string>("");
-        parameter_list.push_back(param);
-    }
+        // Extract parameter names from JSON
+        vector< string > parameter_list;
+        if( !ok || !json.getStringArray("parameters",parameter_list) )
+            parameter_list.clear();
+        handler(parameter_list);
+    });
+}
 
-    return parameter_list;
+//-----------------------------------------------------------------------------
+boost::optional<HandleInfo> CommandInterface::requestHandleUDP(int port, string hostname, int start_angle, char packet_type)
+{
+    return requestHandleUDPAsync(port,hostname,start_angle,packet_type).get();
+}
 
+//-----------------------------------------------------------------------------
+future< boost::optional<HandleInfo> > CommandInterface::requestHandleUDPAsync(int port, string hostname, int start_angle, char packet_type)
+{
+    shared_ptr< promise< boost::optional<HandleInfo> > > result = make_shared< promise< boost::optional<HandleInfo> > >();
+    requestHandleUDPAsync(port,hostname,start_angle,packet_type,fulfill(result));
+    return result->get_future();
 }
 
 //-----------------------------------------------------------------------------
-boost::optional<HandleInfo> CommandInterface::requestHandleUDP(int port, string hostname, int start_angle)
+void CommandInterface::requestHandleUDPAsync(int port, string hostname, int start_angle, char packet_type, const function<void (boost::optional<HandleInfo>)> &handler)
 {
-    // Prepare HTTP request
+    // The local address is taken from the HTTP connections instead of being looked up on the calling thread,
+    // a connection is established with a harmless command if there is none yet
     if( hostname == "" )
-        hostname = discoverLocalIP();
+    {
+        strand_.post(guarded([this,port,start_angle,packet_type,handler]()
+        {
+            if( !local_address_.empty() )
+                requestHandleUDPAsync(port,local_address_,start_angle,packet_type,handler);
+            else
+            {
+                sendHttpCommand("get_protocol_info","","",[this,port,start_angle,packet_type,handler](bool, const JsonReader&)
+                {
+                    if( local_address_.empty() )
+                        handler(boost::optional<HandleInfo>());
+                    else
+                        requestHandleUDPAsync(port,local_address_,start_angle,packet_type,handler);
+                });
+            }
+        }));
+        return;
+    }
+
+    // Prepare HTTP request
     map< string, string > params;
-    params["packet_type"] = "C";
+    params["packet_type"] = string(1,packet_type);
     params["start_angle"] = to_string(start_angle);
     params["port"] = to_string(port);
     params["address"] = hostname;
 
     // Request handle via HTTP/JSON request/response
-    if( !sendHttpCommand("request_handle_udp", params) || !checkErrorCode() )
-        return boost::optional<HandleInfo>();
+    sendHttpCommand("request_handle_udp",params,[port,hostname,start_angle,packet_type,handler](bool ok, const JsonReader& json)
+    {
+        // Extract handle info from JSON response
+        boost::optional<string> handle = json.getString("handle");
+        if( !ok || !handle )
+        {
+            handler(boost::optional<HandleInfo>());
+            return;
+        }
 
-    // Extract handle info from JSON response
-    boost::optional<string> handle = pt_.get_optional<string>("handle");
-    if(!handle)
-        return boost::optional<HandleInfo>();
+        // Prepare return value
+        HandleInfo hi;
+        hi.handle_type = HandleInfo::HANDLE_TYPE_UDP;
+        hi.handle = *handle;
+        hi.hostname = hostname;
+        hi.port = port;
+        hi.packet_type = packet_type;
+        hi.start_angle = start_angle;
+        hi.watchdog_enabled = true;
+        hi.watchdog_timeout = 60000;
+        handler(hi);
+    });
+}
 
-    // Prepare return value
-    HandleInfo hi;
-    hi.handle_type = HandleInfo::HANDLE_TYPE_UDP;
-    hi.handle = *handle;
-    hi.hostname = hostname;
-    hi.port = port;
-    hi.packet_type = 'C';
-    hi.start_angle = start_angle;
-    hi.watchdog_enabled = true;
-    hi.watchdog_timeout = 60000;
-    return hi;
+//-----------------------------------------------------------------------------
+boost::optional<HandleInfo> CommandInterface::requestHandleTCP(int start_angle, char packet_type)
+{
+    return requestHandleTCPAsync(start_angle,packet_type).get();
+}
+
+//-----------------------------------------------------------------------------
+future< boost::optional<HandleInfo> > CommandInterface::requestHandleTCPAsync(int start_angle, char packet_type)
+{
+    shared_ptr< promise< boost::optional<HandleInfo> > > result = make_shared< promise< boost::optional<HandleInfo> > >();
+    requestHandleTCPAsync(start_angle,packet_type,fulfill(result));
+    return result->get_future();
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::requestHandleTCPAsync(int start_angle, char packet_type, const function<void (boost::optional<HandleInfo>)> &handler)
+{
+    // Prepare HTTP request
+    map< string, string > params;
+    params["packet_type"] = string(1,packet_type);
+    params["start_angle"] = to_string(start_angle);
+
+    // Request handle via HTTP/JSON request/response
+    const string hostname = http_host_;
+    sendHttpCommand("request_handle_tcp",params,[hostname,start_angle,packet_type,handler](bool ok, const JsonReader& json)
+    {
+        // Extract handle info from JSON response
+        boost::optional<string> handle = json.getString("handle");
+        boost::optional<int> port = json.getInt("port");
+        if( !ok || !handle || !port )
+        {
+            handler(boost::optional<HandleInfo>());
+            return;
+        }
+
+        // Prepare return value
+        HandleInfo hi;
+        hi.handle_type = HandleInfo::HANDLE_TYPE_TCP;
+        hi.handle = *handle;
+        hi.hostname = hostname;
+        hi.port = *port;
+        hi.packet_type = packet_type;
+        hi.start_angle = start_angle;
+        hi.watchdog_enabled = true;
+        hi.watchdog_timeout = 60000;
+        handler(hi);
+    });
 }
 
 //-----------------------------------------------------------------------------
 bool CommandInterface::releaseHandle(const string& handle)
 {
-    if( !sendHttpCommand("release_handle", "handle", handle) || !checkErrorCode() )
-        return false;
-    return true;
+    return releaseHandleAsync(handle).get();
+}
+
+//-----------------------------------------------------------------------------
+future<bool> CommandInterface::releaseHandleAsync(const string &handle)
+{
+    shared_ptr< promise<bool> > result = make_shared< promise<bool> >();
+    releaseHandleAsync(handle,fulfill(result));
+    return result->get_future();
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::releaseHandleAsync(const string &handle, const ResultHandler &handler)
+{
+    sendResultCommand("release_handle","handle",handle,handler);
 }
 
 //-----------------------------------------------------------------------------
 bool CommandInterface::startScanOutput(const string& handle)
 {
-    if( !sendHttpCommand("start_scanoutput", "handle", handle) || !checkErrorCode() )
-        return false;
-    return true;
+    return startScanOutputAsync(handle).get();
+}
+
+//-----------------------------------------------------------------------------
+future<bool> CommandInterface::startScanOutputAsync(const string &handle)
+{
+    shared_ptr< promise<bool> > result = make_shared< promise<bool> >();
+    startScanOutputAsync(handle,fulfill(result));
+    return result->get_future();
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::startScanOutputAsync(const string &handle, const ResultHandler &handler)
+{
+    sendResultCommand("start_scanoutput","handle",handle,handler);
 }
 
 //-----------------------------------------------------------------------------
 bool CommandInterface::stopScanOutput(const string& handle)
 {
-    if( !sendHttpCommand("stop_scanoutput", "handle", handle) || !checkErrorCode() )
-        return false;
-    return true;
+    return stopScanOutputAsync(handle).get();
 }
+
 //-----------------------------------------------------------------------------
-bool CommandInterface::feedWatchdog(const string &handle)
+future<bool> CommandInterface::stopScanOutputAsync(const string &handle)
 {
-    if( !sendHttpCommand("feed_watchdog", "handle", handle) || !checkErrorCode() )
-        return false;
-    return true;
+    shared_ptr< promise<bool> > result = make_shared< promise<bool> >();
+    stopScanOutputAsync(handle,fulfill(result));
+    return result->get_future();
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::stopScanOutputAsync(const string &handle, const ResultHandler &handler)
+{
+    sendResultCommand("stop_scanoutput","handle",handle,handler);
+}
+
+//-----------------------------------------------------------------------------
+bool CommandInterface::feedWatchdog(const string& handle)
+{
+    return feedWatchdogAsync(handle).get();
+}
+
+//-----------------------------------------------------------------------------
+future<bool> CommandInterface::feedWatchdogAsync(const string &handle)
+{
+    shared_ptr< promise<bool> > result = make_shared< promise<bool> >();
+    feedWatchdogAsync(handle,fulfill(result));
+    return result->get_future();
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::feedWatchdogAsync(const string &handle, const ResultHandler &handler)
+{
+    sendResultCommand("feed_watchdog","handle",handle,handler);
 }
 
 //-----------------------------------------------------------------------------
 bool CommandInterface::rebootDevice()
 {
-    if( !sendHttpCommand("reboot_device") || !checkErrorCode() )
-        return false;
-    return true;
+    return rebootDeviceAsync().get();
+}
+
+//-----------------------------------------------------------------------------
+future<bool> CommandInterface::rebootDeviceAsync()
+{
+    shared_ptr< promise<bool> > result = make_shared< promise<bool> >();
+    rebootDeviceAsync(fulfill(result));
+    return result->get_future();
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::rebootDeviceAsync(const ResultHandler &handler)
+{
+    sendResultCommand("reboot_device","","",handler);
 }
 
 //-----------------------------------------------------------------------------
 bool CommandInterface::resetParameters(const vector<string> &names)
+{
+    return resetParametersAsync(names).get();
+}
+
+//-----------------------------------------------------------------------------
+future<bool> CommandInterface::resetParametersAsync(const vector<string> &names)
+{
+    shared_ptr< promise<bool> > result = make_shared< promise<bool> >();
+    resetParametersAsync(names,fulfill(result));
+    return result->get_future();
+}
+
+//-----------------------------------------------------------------------------
+void CommandInterface::resetParametersAsync(const vector<string> &names, const ResultHandler &handler)
 {
     // Prepare HTTP request
     string namelist;
@@ -348,10 +909,7 @@ bool CommandInterface::resetParameters(const vector<string> &names)
         namelist += (s + ";");
     namelist.substr(0,namelist.size()-1);
 
-    if( !sendHttpCommand("reset_parameter","list",namelist) || ! checkErrorCode()  )
-        return false;
-
-    return true;
+    sendResultCommand("reset_parameter","list",namelist,handler);
 }
 
 //-----------------------------------------------------------------------------
@@ -1,29 +1,78 @@
 
 #include "data_receiver.h"
-#include <chrono>
+#include <payload_unpack.h>
 #include <ctime>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <chrono>
 using namespace std;
 
 namespace pepperl_fuchs {
 
 //-----------------------------------------------------------------------------
-DataReceiver::DataReceiver():inbuf_(4096),instream_(&inbuf_),ring_buffer_(65536),scan_data_()
+static bool compareFirstIndex(const PacketHeader& a, const PacketHeader& b)
 {
-    udp_socket_ = 0;
-    udp_port_ = -1;
-    is_connected_ = false;
+    return a.first_index < b.first_index;
+}
+
+//-----------------------------------------------------------------------------
+DataReceiver::DataReceiver(ReceiveMode receive_mode, boost::asio::io_service* io_service):DataReceiver(ReceiverOptions(receive_mode),io_service)
+{
+}
+
+//-----------------------------------------------------------------------------
+DataReceiver::DataReceiver(const ReceiverOptions& options, boost::asio::io_service* io_service):inbuf_(4096),instream_(&inbuf_),receive_mode_(options.receive_mode),options_(options),ring_buffer_(65536),scan_queue_(options.queue_policy == QUEUE_KEEP_LATEST ? 1 : options.queue_depth),free_scans_(8)
+{
+    initialize(io_service);
+    if( receive_mode_ == RECEIVE_MODE_INJECT )
+    {
+        is_connected_ = true;
+        return;
+    }
+
+    // Preallocate datagram slots for recvmmsg(), a single one takes any datagram
+    const size_t num_slots = ( receive_mode_ == RECEIVE_MODE_BATCH ) ? BATCH_SIZE : 1;
+    const size_t slot_size = ( receive_mode_ == RECEIVE_MODE_BATCH ) ? BATCH_SLOT_SIZE : CAPTURE_MAX_RECORD_SIZE;
+    batch_buffer_.resize(num_slots*slot_size);
+    batch_msgs_.resize(num_slots);
+    batch_iovecs_.resize(num_slots);
+    batch_controls_.resize(num_slots);
+    for( size_t i=0; i<num_slots; i++ )
+    {
+        batch_iovecs_[i].iov_base = &batch_buffer_[i*slot_size];
+        batch_iovecs_[i].iov_len = slot_size;
+        memset(&batch_msgs_[i],0,sizeof(mmsghdr));
+        batch_msgs_[i].msg_hdr.msg_iov = &batch_iovecs_[i];
+        batch_msgs_[i].msg_hdr.msg_iovlen = 1;
+        batch_msgs_[i].msg_hdr.msg_control = &batch_controls_[i][0];
+    }
 
     try
     {
-        udp_socket_ = new boost::asio::ip::udp::socket(io_service_, boost::asio::ip::udp::v4());
-        udp_socket_->bind(boost::asio::ip::udp::endpoint(boost::asio::ip::udp::v4(), 0));
+        udp_socket_ = new boost::asio::ip::udp::socket(*io_service_, boost::asio::ip::udp::v4());
+        applySocketOptions(udp_socket_->native_handle());
+        boost::asio::ip::address bind_address = boost::asio::ip::address_v4::any();
+        if( !options_.bind_address.empty() )
+            bind_address = boost::asio::ip::address::from_string(options_.bind_address);
+        udp_socket_->bind(boost::asio::ip::udp::endpoint(bind_address, options_.udp_port));
         udp_port_ = udp_socket_->local_endpoint().port();
+        effective_options_.bind_address = options_.bind_address;
+        effective_options_.udp_port = udp_port_;
+
+        // Let the kernel stamp every datagram on arrival and report the datagrams it had to drop
+        int enable = 1;
+        if( setsockopt(udp_socket_->native_handle(), SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) < 0 )
+            cerr << "ERROR: Could not enable kernel receive timestamps, using user space time instead" << endl;
+        if( setsockopt(udp_socket_->native_handle(), SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable)) < 0 )
+            cerr << "ERROR: Could not enable kernel drop counter" << endl;
         // Start async reading
-        udp_socket_->async_receive_from(boost::asio::buffer(&udp_buffer_[0],udp_buffer_.size()), udp_endpoint_,
-                                        boost::bind(&DataReceiver::handleSocketRead, this,
-                                                    boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
-        io_service_thread_ = boost::thread(boost::bind(&boost::asio::io_service::run, &io_service_));
         is_connected_ = true;
+        startReceive();
+        if( owns_io_service_ )
+            io_service_thread_ = boost::thread(boost::bind(&boost::asio::io_service::run, io_service_));
+        applyThreadOptions();
     }
     catch (exception& e)
     {
@@ -33,11 +82,200 @@ DataReceiver::DataReceiver():inbuf_(4096),instream_(&inbuf_),ring_buffer_(65536)
 
 }
 
+//-----------------------------------------------------------------------------
+DataReceiver::DataReceiver(const string &hostname, int tcp_port, boost::asio::io_service* io_service, const ReceiverOptions& options):inbuf_(4096),instream_(&inbuf_),receive_mode_(RECEIVE_MODE_ASYNC),options_(options),ring_buffer_(65536),scan_queue_(options.queue_policy == QUEUE_KEEP_LATEST ? 1 : options.queue_depth),free_scans_(8)
+{
+    initialize(io_service);
+
+    try
+    {
+        // Lookup endpoint and etablish connection
+        boost::asio::ip::tcp::resolver resolver(*io_service_);
+        boost::asio::ip::tcp::resolver::query query(hostname, to_string(tcp_port));
+        boost::asio::ip::tcp::resolver::iterator endpoint_iterator = resolver.resolve(query);
+        tcp_socket_ = new boost::asio::ip::tcp::socket(*io_service_);
+        tcp_socket_->open(endpoint_iterator->endpoint().protocol());
+        applySocketOptions(tcp_socket_->native_handle());
+        tcp_socket_->connect(*endpoint_iterator);
+
+        // Start async reading
+        is_connected_ = true;
+        startReceive();
+        if( owns_io_service_ )
+            io_service_thread_ = boost::thread(boost::bind(&boost::asio::io_service::run, io_service_));
+        applyThreadOptions();
+    }
+    catch (exception& e)
+    {
+        cerr << "Exception: " <<  e.what() << endl;
+    }
+    cout << "Receiving scanner data from TCP " << hostname << ":" << tcp_port << " ... \n"<<endl;
+}
+
+//-----------------------------------------------------------------------------
+void DataReceiver::initialize(boost::asio::io_service* io_service)
+{
+    owns_io_service_ = ( io_service == 0 );
+    io_service_ = owns_io_service_ ? new boost::asio::io_service() : io_service;
+    handler_guard_ = make_shared<HandlerGuard>();
+    handler_guard_->receiver = this;
+    udp_socket_ = 0;
+    tcp_socket_ = 0;
+    udp_port_ = -1;
+    is_connected_ = false;
+    is_recording_ = false;
+    stat_datagrams_ = 0;
+    stat_datagrams_truncated_ = 0;
+    stat_datagrams_invalid_ = 0;
+    stat_wakeups_ = 0;
+    stat_bytes_ = 0;
+    stat_packets_ = 0;
+    stat_scans_completed_ = 0;
+    stat_scans_incomplete_ = 0;
+    stat_scans_dropped_ = 0;
+    stat_producer_blocks_ = 0;
+    stat_queue_high_water_ = 0;
+    stat_resyncs_ = 0;
+    stat_skipped_bytes_ = 0;
+    stat_kernel_drops_ = 0;
+    stat_clock_offset_ = 0;
+    stat_clock_drift_ = 0.0;
+    stat_stack_latency_ = 0;
+    stat_transfer_latency_ = 0;
+    receive_time_ = 0;
+    resync_offset_ = 0;
+    last_scan_number_ = 0;
+    has_last_scan_ = false;
+    last_data_time_ = monotonicNanoseconds();
+    data_timeout_ = 2000000000;
+    last_packet_time_ = 0;
+    packet_interval_ = 0;
+    gap_pending_ = false;
+    effective_options_ = ReceiverOptions(receive_mode_);
+
+    // Blocking a shared IO thread would stall every receiver served by it, injected data is not parsed on it
+    if( options_.queue_policy == QUEUE_BLOCK_PRODUCER && !owns_io_service_ && receive_mode_ != RECEIVE_MODE_INJECT )
+    {
+        cerr << "ERROR: QUEUE_BLOCK_PRODUCER is not supported on a shared io_service, dropping the oldest scans instead" << endl;
+        options_.queue_policy = QUEUE_DROP_OLDEST;
+    }
+    effective_options_.queue_policy = options_.queue_policy;
+    effective_options_.queue_depth = scan_queue_.capacity();
+}
+
+//-----------------------------------------------------------------------------
+void DataReceiver::applySocketOptions(int fd)
+{
+    if( !options_.bind_device.empty() )
+    {
+        if( setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, options_.bind_device.c_str(), options_.bind_device.size()) < 0 )
+            cerr << "ERROR: Could not bind socket to device " << options_.bind_device << ": " << strerror(errno) << endl;
+        else
+            effective_options_.bind_device = options_.bind_device;
+    }
+
+    if( options_.receive_buffer_size > 0 )
+    {
+        // SO_RCVBUF is silently capped at net.core.rmem_max, the privileged variant is not
+        int size = options_.receive_buffer_size;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        int effective_size = 0;
+        socklen_t length = sizeof(effective_size);
+        getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &effective_size, &length);
+        if( effective_size < 2*size && setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0 )
+            cerr << "ERROR: Receive buffer limited by net.core.rmem_max, SO_RCVBUFFORCE failed: " << strerror(errno) << endl;
+    }
+    int receive_buffer_size = 0;
+    socklen_t length = sizeof(receive_buffer_size);
+    if( getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer_size, &length) == 0 )
+        effective_options_.receive_buffer_size = receive_buffer_size;
+
+    if( options_.busy_poll_us > 0 )
+    {
+        int busy_poll = options_.busy_poll_us;
+        if( setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)) < 0 )
+            cerr << "ERROR: Could not enable busy polling: " << strerror(errno) << endl;
+    }
+    int busy_poll = 0;
+    length = sizeof(busy_poll);
+    if( getsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, &length) == 0 )
+        effective_options_.busy_poll_us = busy_poll;
+}
+
+//-----------------------------------------------------------------------------
+void DataReceiver::applyThreadOptions()
+{
+    if( options_.cpu_affinity < 0 && options_.realtime_priority <= 0 )
+        return;
+    if( !owns_io_service_ )
+    {
+        cerr << "ERROR: IO thread options are ignored for receivers on a shared io_service" << endl;
+        return;
+    }
+
+    const pthread_t thread = io_service_thread_.native_handle();
+    if( options_.cpu_affinity >= 0 )
+    {
+        if( setThreadAffinity(thread,options_.cpu_affinity) )
+            effective_options_.cpu_affinity = options_.cpu_affinity;
+        else
+            cerr << "ERROR: Could not pin IO thread to CPU " << options_.cpu_affinity << endl;
+    }
+    if( options_.realtime_priority > 0 )
+    {
+        if( setThreadRealtimePriority(thread,options_.realtime_priority) )
+            effective_options_.realtime_priority = options_.realtime_priority;
+        else
+            cerr << "ERROR: Could not set SCHED_FIFO priority " << options_.realtime_priority << " for IO thread" << endl;
+    }
+}
+
 //-----------------------------------------------------------------------------
 DataReceiver::~DataReceiver()
 {
     disconnect();
+
+    // Handlers still queued on a shared io_service find the receiver gone, destroying the
+    // sockets makes their pending operations complete with operation_aborted
+    lock_guard<recursive_mutex> lock(handler_guard_->mutex);
+    handler_guard_->receiver = 0;
     delete udp_socket_;
+    delete tcp_socket_;
+    udp_socket_ = 0;
+    tcp_socket_ = 0;
+    if( owns_io_service_ )
+        delete io_service_;
+}
+
+//-----------------------------------------------------------------------------
+void DataReceiver::startReceive()
+{
+    if( tcp_socket_ )
+        // Large reads, bounded by the free space of the ring buffer, which takes everything not parsed in place
+        tcp_socket_->async_read_some(boost::asio::buffer(&udp_buffer_[0],min(udp_buffer_.size(),ring_buffer_.capacity()-ring_buffer_.size())),
+                                     boost::bind(&DataReceiver::guardedSocketRead, handler_guard_,
+                                                 boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+    else
+        // Wait for readiness only, datagrams are read with recvmmsg() to get their receive timestamps
+        udp_socket_->async_receive(boost::asio::null_buffers(),
+                                   boost::bind(&DataReceiver::guardedSocketReadable, handler_guard_,
+                                               boost::asio::placeholders::error));
+}
+
+//-----------------------------------------------------------------------------
+void DataReceiver::guardedSocketRead(const shared_ptr<HandlerGuard> &guard, const boost::system::error_code &error, size_t bytes_transferred)
+{
+    lock_guard<recursive_mutex> lock(guard->mutex);
+    if( guard->receiver )
+        guard->receiver->handleSocketRead(error,bytes_transferred);
+}
+
+//-----------------------------------------------------------------------------
+void DataReceiver::guardedSocketReadable(const shared_ptr<HandlerGuard> &guard, const boost::system::error_code &error)
+{
+    lock_guard<recursive_mutex> lock(guard->mutex);
+    if( guard->receiver )
+        guard->receiver->handleSocketReadable(error);
 }
 
 //-----------------------------------------------------------------------------
@@ -45,129 +283,676 @@ void DataReceiver::handleSocketRead(const boost::system::error_code &error, size
 {
     if (!error )
     {
-        // Read all received data and write it to the internal ring buffer
-        writeBufferBack(&udp_buffer_[0],bytes_transferred);
-
-        // Handle (read and parse) packets stored in the internal ring buffer
-        while( handleNextPacket() ) {}
+        stat_wakeups_.fetch_add(1,memory_order_relaxed);
+        receive_time_ = monotonicNanoseconds();
+        last_data_time_ = receive_time_;
+        if( is_recording_.load(memory_order_relaxed) )
+        {
+            timespec realtime;
+            clock_gettime(CLOCK_REALTIME,&realtime);
+            recordData(&udp_buffer_[0],bytes_transferred,int64_t(realtime.tv_sec)*1000000000 + realtime.tv_nsec);
+        }
+        handleReceivedData(&udp_buffer_[0],bytes_transferred);
+        stat_parse_time_.record(monotonicNanoseconds()-receive_time_);
 
         // Read data asynchronously
-        udp_socket_->async_receive_from(boost::asio::buffer(&udp_buffer_[0],udp_buffer_.size()), udp_endpoint_,
-                                        boost::bind(&DataReceiver::handleSocketRead, this,
-                                                    boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+        if( is_connected_ )
+            startReceive();
     }
     else
+        handleSocketError(error);
+}
+
+//-----------------------------------------------------------------------------
+void DataReceiver::handleSocketReadable(const boost::system::error_code &error)
+{
+    if( !error )
     {
-        if( error.value() != 995 )
-            cerr << "ERROR: " << "data connection error: " << error.message() << "(" << error.value() << ")" << endl;
-        disconnect();
+        stat_wakeups_.fetch_add(1,memory_order_relaxed);
+
+        // Kernel timestamps are CLOCK_REALTIME, the offset to CLOCK_MONOTONIC is taken once per wakeup
+        timespec realtime;
+        clock_gettime(CLOCK_REALTIME,&realtime);
+        const int64_t now = monotonicNanoseconds();
+        const int64_t realtime_offset = int64_t(realtime.tv_sec)*1000000000 + realtime.tv_nsec - now;
+        last_data_time_ = now;
+
+        // Read a single datagram, or drain the socket in batch mode: fetch up to BATCH_SIZE
+        // datagrams per syscall until it would block
+        int num_msgs = 0;
+        do
+        {
+            for( size_t i=0; i<batch_msgs_.size(); i++ )
+                batch_msgs_[i].msg_hdr.msg_controllen = BATCH_CONTROL_SIZE;
+            num_msgs = recvmmsg(udp_socket_->native_handle(), &batch_msgs_[0], batch_msgs_.size(), MSG_DONTWAIT, 0);
+            for( int i=0; i<num_msgs; i++ )
+            {
+                // Datagrams larger than a slot are no scanner packets
+                if( batch_msgs_[i].msg_hdr.msg_flags & MSG_TRUNC )
+                {
+                    stat_datagrams_truncated_.fetch_add(1,memory_order_relaxed);
+                    continue;
+                }
+                stat_datagrams_.fetch_add(1,memory_order_relaxed);
+                char* datagram = (char*) batch_iovecs_[i].iov_base;
+                receive_time_ = handleControlMessages(batch_msgs_[i].msg_hdr,realtime_offset,now);
+                const int64_t parse_start = monotonicNanoseconds();
+                stat_stack_latency_.store(parse_start-receive_time_,memory_order_relaxed);
+                if( is_recording_.load(memory_order_relaxed) )
+                    recordData(datagram,batch_msgs_[i].msg_len,receive_time_+realtime_offset);
+                handleReceivedData(datagram,batch_msgs_[i].msg_len);
+                stat_parse_time_.record(monotonicNanoseconds()-parse_start);
+            }
+        }
+        while( receive_mode_ == RECEIVE_MODE_BATCH && num_msgs == (int) BATCH_SIZE );
+
+        if( num_msgs < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+            handleSocketError(boost::system::error_code(errno,boost::system::system_category()));
+        else if( is_connected_ )
+            startReceive();
+    }
+    else
+        handleSocketError(error);
+}
+
+//-----------------------------------------------------------------------------
+void DataReceiver::injectData(char *data, size_t size, int64_t receive_time)
+{
+    if( !is_connected_ )
+        return;
+    stat_wakeups_.fetch_add(1,memory_order_relaxed);
+    stat_datagrams_.fetch_add(1,memory_order_relaxed);
+    receive_time_ = receive_time;
+    last_data_time_ = monotonicNanoseconds();
+    const int64_t parse_start = monotonicNanoseconds();
+    handleReceivedData(data,size);
+    stat_parse_time_.record(monotonicNanoseconds()-parse_start);
+}
+
+//-----------------------------------------------------------------------------
+int64_t DataReceiver::handleControlMessages(const msghdr &msg, int64_t realtime_offset_ns, int64_t now_ns)
+{
+    int64_t receive_time = now_ns;
+    for( cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR((msghdr*) &msg,cmsg) )
+    {
+        if( cmsg->cmsg_level != SOL_SOCKET )
+            continue;
+        if( cmsg->cmsg_type == SCM_TIMESTAMPNS )
+        {
+            timespec ts;
+            memcpy(&ts,CMSG_DATA(cmsg),sizeof(ts));
+            receive_time = int64_t(ts.tv_sec)*1000000000 + ts.tv_nsec - realtime_offset_ns;
+        }
+        else if( cmsg->cmsg_type == SO_RXQ_OVFL )
+        {
+            // Running total of drops since the socket has been opened, only sent once drops occurred
+            uint32_t drops;
+            memcpy(&drops,CMSG_DATA(cmsg),sizeof(drops));
+            stat_kernel_drops_.store(drops,memory_order_relaxed);
+        }
+    }
+    return receive_time;
+}
+
+//-----------------------------------------------------------------------------
+void DataReceiver::handleSocketError(const boost::system::error_code &error)
+{
+    if( error.value() != 995 && error != boost::asio::error::operation_aborted )
+        cerr << "ERROR: " << "data connection error: " << error.message() << "(" << error.value() << ")" << endl;
+    disconnect();
+}
+
+//-----------------------------------------------------------------------------
+void DataReceiver::handleReceivedData(char *data, size_t size)
+{
+    stat_bytes_.fetch_add(size,memory_order_relaxed);
+
+    // The scanner sends exactly one packet per datagram, later datagrams can never complete a
+    // broken one, so it is dropped instead of holding back the following ones
+    if( udp_socket_ )
+    {
+        while( size >= sizeof(PacketHeader) && handlePacket(data,size) )
+        {
+            const size_t packet_size = ((const PacketHeader*) data)->packet_size;
+            data += packet_size;
+            size -= packet_size;
+        }
+        if( size > 0 )
+            stat_datagrams_invalid_.fetch_add(1,memory_order_relaxed);
+        return;
+    }
+
+    // Fast path: TCP reads mostly start at a packet boundary, so complete packets are validated
+    // and decoded in place without touching the internal ring buffer
+    if( ring_buffer_.empty() )
+    {
+        while( size >= sizeof(PacketHeader) && handlePacket(data,size) )
+        {
+            const size_t packet_size = ((const PacketHeader*) data)->packet_size;
+            data += packet_size;
+            size -= packet_size;
+        }
+    }
+
+    if( size > 0 )
+    {
+        // Resync fallback: write all received data to the internal ring buffer, dropping
+        // the oldest data if an implausible packet size kept too much of it waiting
+        if( ring_buffer_.size()+size > ring_buffer_.capacity() )
+        {
+            const size_t overflow = min(ring_buffer_.size()+size-ring_buffer_.capacity(),ring_buffer_.size());
+            stat_resyncs_.fetch_add(1,memory_order_relaxed);
+            stat_skipped_bytes_.fetch_add(overflow,memory_order_relaxed);
+            ring_buffer_.erase_begin(overflow);
+        }
+        if( size > ring_buffer_.capacity() )
+            return;
+        writeBufferBack(data,size);
+
+        // Handle (read and parse) packets stored in the internal ring buffer
+        while( handleNextPacket() ) {}
     }
-    last_data_time_ = time(0);
 }
 
 //-----------------------------------------------------------------------------
 bool DataReceiver::handleNextPacket()
 {
-    // Search for a packet
+    // Search for a packet and drop everything in front of it
     int packet_start = findPacketStart();
-    if( packet_start<0 )
+    if( resync_offset_ > 0 )
+    {
+        stat_resyncs_.fetch_add(1,memory_order_relaxed);
+        stat_skipped_bytes_.fetch_add(resync_offset_,memory_order_relaxed);
+        ring_buffer_.erase_begin(resync_offset_);
+        resync_offset_ = 0;
+    }
+    if( packet_start<0 || ring_buffer_.size()<sizeof(PacketHeader) )
         return false;
 
-    // Try to retrieve packet
+    // Magic bytes may occur by chance, skip them if the header is implausible
+    PacketHeader header;
+    readBufferFront((char*) &header,sizeof(PacketHeader));
+    if( header.header_size < sizeof(PacketHeader) || header.packet_size < header.header_size
+        || header.packet_size > ring_buffer_.capacity() )
+    {
+        resync_offset_ = 1;
+        return true;
+    }
+
+    // Wait for the rest of the packet
+    if( ring_buffer_.size() < header.packet_size )
+        return false;
+
+    // Read header+payload data and erase packet from ring buffer
     char buf[65536];
-    PacketTypeC* p = (PacketTypeC*) buf;
-    if( !retrievePacket(packet_start,p) )
+    readBufferFront(buf,header.packet_size);
+
+    // A plausible header may still describe an invalid packet, search on behind its magic bytes then
+    if( !handlePacket(buf,header.packet_size) )
+    {
+        resync_offset_ = 1;
+        return true;
+    }
+    ring_buffer_.erase_begin(header.packet_size);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool DataReceiver::isValidPacket(const PacketHeader &header, size_t size)
+{
+    const size_t point_size = payloadPointSize(header.packet_type);
+    return size >= sizeof(PacketHeader)
+        && header.magic == 0xa25c
+        && point_size > 0
+        && header.header_size >= sizeof(PacketHeader)
+        && header.packet_size <= size
+        && header.header_size + header.num_points_packet*point_size <= header.packet_size
+        && header.num_points_packet > 0
+        && header.first_index + header.num_points_packet <= header.num_points_scan;
+}
+
+//-----------------------------------------------------------------------------
+bool DataReceiver::handlePacket(const char *data, size_t size)
+{
+    const PacketHeader& header = *((const PacketHeader*) data);
+    if( !isValidPacket(header,size) )
         return false;
+    stat_packets_.fetch_add(1,memory_order_relaxed);
+    last_packet_time_.store(receive_time_,memory_order_relaxed);
 
-    // Lock internal outgoing data queue, automatically unlocks at end of function
-    unique_lock<mutex> lock(data_mutex_);
+    // After an interruption of the data stream the scans in progress can not be completed anymore
+    if( gap_pending_.load(memory_order_relaxed) )
+        pushOpenScans();
 
-    // Create new scan container if necessary
-    if( p->header.packet_number == 1 || scan_data_.empty() )
+    // Packets are assigned to scans by scan_number. The previous scan stays open next to the current
+    // one for a few packets, so packets reordered across a scan boundary still complete it.
+    OpenScan* open = 0;
+    if( isOpenScan(current_scan_,header) )
+        open = &current_scan_;
+    else if( isOpenScan(previous_scan_,header) )
+        open = &previous_scan_;
+    else
     {
-        scan_data_.emplace_back();
-        if( scan_data_.size()>100 )
+        if( isLateScan(header.scan_number) )
+            return true;
+        if( !previous_scan_.scan.headers.empty() )
+            pushScan(previous_scan_);
+
+        // A newer scan moves the current one to previous_scan_, anything else means it can not be completed anymore
+        if( !current_scan_.scan.headers.empty() )
         {
-            scan_data_.pop_front();
-            cerr << "Too many scans in receiver queue: Dropping scans!" << endl;
+            if( (int16_t) (uint16_t) (header.scan_number - current_scan_.scan_number) > 0 )
+                swap(previous_scan_,current_scan_);
+            else
+                pushScan(current_scan_);
         }
-        data_notifier_.notify_one();
+        prepareScan(current_scan_,header);
+        open = &current_scan_;
     }
-    ScanData& scandata = scan_data_.back();
+    ScanData& scandata = open->scan;
 
-    // Parse payload of packet
-    uint32_t* p_scan_data = (uint32_t*) &buf[p->header.header_size];
-    int num_scan_points = p->header.num_points_packet;
+    // Every packet is a sample for the clock model
+    scanner_clock_.addSample(header.timestamp_raw,receive_time_);
+    const int64_t transfer_latency = receive_time_ - scanner_clock_.toHostTime(header.timestamp_raw);
+    stat_transfer_latency_.store(transfer_latency,memory_order_relaxed);
+    stat_clock_offset_.store(scanner_clock_.getOffset(),memory_order_relaxed);
+    stat_clock_drift_.store(scanner_clock_.getDriftPpm(),memory_order_relaxed);
 
-    for( int i=0; i<num_scan_points; i++ )
-    {
-        unsigned int data = p_scan_data[i];
-        unsigned int distance = (data & 0x000FFFFF);
-        unsigned int amplitude = (data & 0xFFFFF000) >> 20;
+    // Drop duplicates
+    const size_t packet_bit = header.packet_number>0 ? header.packet_number-1 : 0;
+    if( packet_bit/64 >= open->received_packets.size() )
+        open->received_packets.resize(packet_bit/64+1,0);
+    const uint64_t packet_flag = uint64_t(1) << (packet_bit%64);
+    if( open->received_packets[packet_bit/64] & packet_flag )
+        return true;
+    open->received_packets[packet_bit/64] |= packet_flag;
 
-        scandata.distance_data.push_back(distance);
-        scandata.amplitude_data.push_back(amplitude);
+    // Unpack payload directly from the given buffer into the scan arrays at its first_index
+    switch( header.packet_type )
+    {
+    case PACKET_TYPE_A:
+        decodePayload< PacketPayload<PACKET_TYPE_A> >(scandata,header,&data[header.header_size]);
+        break;
+    case PACKET_TYPE_B:
+        decodePayload< PacketPayload<PACKET_TYPE_B> >(scandata,header,&data[header.header_size]);
+        break;
+    default:
+        decodePayload< PacketPayload<PACKET_TYPE_C> >(scandata,header,&data[header.header_size]);
+        break;
     }
 
     // Save header
-    scandata.headers.push_back(p->header);
+    scandata.headers.push_back(header);
+    scandata.receive_timestamp = receive_time_;
+
+    // Hand out the sectors completed by this packet, regardless of packets missing in other sectors
+    if( open->sector_subscriptions )
+        emitSectors(*open,header.first_index,header.first_index+header.num_points_packet,false);
+
+    // Hand over a scan as soon as its last missing packet arrived, scans are handed over in order
+    open->received_points += header.num_points_packet;
+    if( open->received_points >= scandata.distance_data.size() )
+    {
+        if( open == &current_scan_ )
+            pushOpenScans();
+        else
+            pushScan(previous_scan_);
+    }
+    else if( !previous_scan_.scan.headers.empty() && current_scan_.scan.headers.size() >= REORDER_WINDOW_PACKETS )
+        pushScan(previous_scan_);
 
     return true;
 }
 
 //-----------------------------------------------------------------------------
-int DataReceiver::findPacketStart()
+bool DataReceiver::isOpenScan(const OpenScan &open, const PacketHeader &header)
+{
+    return !open.scan.headers.empty()
+        && header.scan_number == open.scan_number
+        && header.num_points_scan == open.scan.distance_data.size()
+        && header.packet_type == open.packet_type;
+}
+
+//-----------------------------------------------------------------------------
+template<class Payload>
+void DataReceiver::decodePayload(ScanData &scandata, const PacketHeader &header, const char *payload)
+{
+    Payload::unpack(payload, header.num_points_packet,
+                    &scandata.distance_data[header.first_index],
+                    Payload::HAS_AMPLITUDE ? &scandata.amplitude_data[header.first_index] : 0,
+                    &scandata.valid_mask[0], header.first_index);
+}
+
+//-----------------------------------------------------------------------------
+void DataReceiver::prepareScan(OpenScan &open, const PacketHeader &header)
+{
+    ScanData& scandata = open.scan;
+
+    // Reuse a buffer released by the consumer, a fresh one is only allocated if none is available
+    if( scandata.distance_data.capacity() < header.num_points_scan )
+        free_scans_.pop(scandata);
+
+    // Size the scan once, so packets can be placed at their first_index without reallocating
+    scandata.distance_data.resize(header.num_points_scan);
+    scandata.amplitude_data.resize(header.packet_type != PACKET_TYPE_A ? header.num_points_scan : 0);
+    scandata.valid_mask.assign((header.num_points_scan+63)/64,0);
+    const size_t num_packets = (header.num_points_scan+header.num_points_packet-1)/header.num_points_packet;
+    scandata.headers.reserve(num_packets);
+    scandata.complete = false;
+    scandata.gap_before = gap_pending_.exchange(false,memory_order_relaxed);
+    open.scan_number = header.scan_number;
+    open.packet_type = header.packet_type;
+
+    open.received_packets.assign((num_packets+63)/64,0);
+    open.received_points = 0;
+
+    // Packet size is only known from a packet which is not the last one
+    if( header.packet_number > 1 )
+        open.points_per_packet = header.first_index/(header.packet_number-1);
+    if( header.packet_number <= 1 || open.points_per_packet == 0 )
+        open.points_per_packet = header.num_points_packet;
+
+    // Cadence for link monitoring, scan_frequency is given in mHz
+    if( header.scan_frequency > 0 && open.points_per_packet > 0 )
+    {
+        const size_t packets_per_scan = (header.num_points_scan+open.points_per_packet-1)/open.points_per_packet;
+        packet_interval_.store(int64_t(1e12/(double(header.scan_frequency)*packets_per_scan)),memory_order_relaxed);
+    }
+
+    // Sector subscriptions apply for the whole scan
+    {
+        lock_guard<mutex> lock(subscription_mutex_);
+        open.sector_subscriptions = sector_subscriptions_;
+    }
+    if( open.sector_subscriptions && open.sector_subscriptions->empty() )
+        open.sector_subscriptions.reset();
+    if( !open.sector_subscriptions )
+        return;
+    const vector<SectorSubscription>& subscriptions = *open.sector_subscriptions;
+    open.sector_sizes.resize(subscriptions.size());
+    open.emitted_sectors.resize(subscriptions.size());
+    for( size_t i=0; i<subscriptions.size(); i++ )
+    {
+        size_t sector_size = subscriptions[i].packets_per_sector * open.points_per_packet;
+        if( subscriptions[i].packets_per_sector == 0 && header.angular_increment != 0 )
+            sector_size = (size_t) (subscriptions[i].degrees_per_sector*10000.0/abs(header.angular_increment) + 0.5);
+        sector_size = max(sector_size,(size_t) 1);
+        const size_t num_sectors = (header.num_points_scan+sector_size-1)/sector_size;
+        open.sector_sizes[i] = sector_size;
+        open.emitted_sectors[i].assign((num_sectors+63)/64,0);
+    }
+}
+
+//-----------------------------------------------------------------------------
+void DataReceiver::pushScan(OpenScan &open)
 {
-    if( ring_buffer_.size()<60 )
-        return -1;
-    for( size_t i=0; i<ring_buffer_.size()-4; i++)
+    ScanData& scandata = open.scan;
+    vector<PacketHeader>& headers = scandata.headers;
+
+    // Packets may have arrived out of order
+    if( !is_sorted(headers.begin(),headers.end(),compareFirstIndex) )
+        sort(headers.begin(),headers.end(),compareFirstIndex);
+
+    // Mark the ranges of missing packets as invalid instead of leaving undefined values
+    scandata.complete = ( open.received_points >= scandata.distance_data.size() );
+    if( !scandata.complete )
     {
-        if(   ((unsigned char) ring_buffer_[i])   == 0x5c
-           && ((unsigned char) ring_buffer_[i+1]) == 0xa2
-           && ((unsigned char) ring_buffer_[i+2]) == 0x43
-           && ((unsigned char) ring_buffer_[i+3]) == 0x00 )
+        size_t next_index = 0;
+        for( size_t i=0; i<=headers.size(); i++ )
         {
-            return i;
+            const size_t gap_end = (i<headers.size()) ? headers[i].first_index : scandata.distance_data.size();
+            if( gap_end > next_index )
+            {
+                fill(scandata.distance_data.begin()+next_index, scandata.distance_data.begin()+gap_end, NO_ECHO_DISTANCE);
+                if( !scandata.amplitude_data.empty() )
+                    fill(scandata.amplitude_data.begin()+next_index, scandata.amplitude_data.begin()+gap_end, 0);
+            }
+            if( i<headers.size() )
+                next_index = max(next_index, (size_t) headers[i].first_index+headers[i].num_points_packet);
         }
     }
-    return -2;
+    if( scandata.complete )
+        stat_scans_completed_.fetch_add(1,memory_order_relaxed);
+    else
+        stat_scans_incomplete_.fetch_add(1,memory_order_relaxed);
+    scandata.host_timestamp = getPointHostTime(headers[0],0);
+    last_scan_number_ = open.scan_number;
+    has_last_scan_ = true;
+
+    // Remaining sectors, possibly containing missing ranges
+    if( open.sector_subscriptions )
+        emitSectors(open,0,scandata.distance_data.size(),true);
+
+    // Take a snapshot of the subscribers, they may be replaced concurrently
+    shared_ptr< const vector<ScanSubscription> > subscriptions;
+    {
+        lock_guard<mutex> lock(subscription_mutex_);
+        subscriptions = scan_subscriptions_;
+    }
+
+    if( subscriptions && !subscriptions->empty() )
+        notifyScanSubscribers(scandata,*subscriptions);
+    else
+        enqueueScan(scandata);
+
+    // Either an empty slot, an evicted or the rejected scan has been swapped into the open scan
+    scandata.distance_data.clear();
+    scandata.amplitude_data.clear();
+    scandata.valid_mask.clear();
+    scandata.headers.clear();
+    scandata.host_timestamp = 0;
+    scandata.receive_timestamp = 0;
+    open.received_points = 0;
 }
 
 //-----------------------------------------------------------------------------
-bool DataReceiver::retrievePacket(size_t start, PacketTypeC *p)
+void DataReceiver::pushOpenScans()
 {
-    if( ring_buffer_.size()<60 )
-        return false;
+    if( !previous_scan_.scan.headers.empty() )
+        pushScan(previous_scan_);
+    if( !current_scan_.scan.headers.empty() )
+        pushScan(current_scan_);
+}
 
-    // Erase preceding bytes
-    ring_buffer_.erase_begin(start);
+//-----------------------------------------------------------------------------
+void DataReceiver::enqueueScan(ScanData &scandata)
+{
+    bool queued = true;
+    switch( options_.queue_policy )
+    {
+    case QUEUE_DROP_NEWEST:
+        queued = scan_queue_.push(scandata);
+        if( !queued )
+            stat_scans_dropped_.fetch_add(1,memory_order_relaxed);
+        break;
+    case QUEUE_BLOCK_PRODUCER:
+        if( !scan_queue_.push(scandata) )
+        {
+            // Only reached on an own IO thread or the injecting thread, see initialize().
+            // Give up on disconnect only, the consumer must not be able to stall shutdown
+            stat_producer_blocks_.fetch_add(1,memory_order_relaxed);
+            do
+                queued = scan_queue_.waitPush(scandata,100);
+            while( !queued && is_connected_ );
+            if( !queued )
+                stat_scans_dropped_.fetch_add(1,memory_order_relaxed);
+        }
+        break;
+    default:
+        // The evicted scan ends up in scandata, so its buffers are reused
+        if( scan_queue_.pushEvict(scandata) )
+            stat_scans_dropped_.fetch_add(1,memory_order_relaxed);
+        break;
+    }
 
-    char* pp = (char*) p;
-    // Read header
-    readBufferFront(pp,60);
+    // Only the IO thread raises the high-water mark
+    const uint64_t queue_size = scan_queue_.size();
+    if( queued && queue_size > stat_queue_high_water_.load(memory_order_relaxed) )
+        stat_queue_high_water_.store(queue_size,memory_order_relaxed);
+}
 
-    if( ring_buffer_.size() < p->header.packet_size )
-        return false;
+//-----------------------------------------------------------------------------
+void DataReceiver::notifyScanSubscribers(const ScanData &scandata, const vector<ScanSubscription> &subscriptions)
+{
+    stat_delivery_latency_.record(monotonicNanoseconds()-scandata.receive_timestamp);
 
-    // Read header+payload data
-    readBufferFront(pp,p->header.packet_size);
+    // Subscribers on other executors need their own copy, as the scan buffers are reused right away
+    shared_ptr<const ScanData> scan_copy;
+    for( const auto& subscription : subscriptions )
+    {
+        if( !subscription.executor )
+        {
+            subscription.callback(scandata);
+            continue;
+        }
+        if( !scan_copy )
+            scan_copy = make_shared<const ScanData>(scandata);
+        const ScanCallback callback = subscription.callback;
+        subscription.executor->post([callback,scan_copy]() { callback(*scan_copy); });
+    }
+}
+
+//-----------------------------------------------------------------------------
+void DataReceiver::emitSectors(OpenScan &open, size_t first_index, size_t end_index, bool force)
+{
+    const ScanData& scandata = open.scan;
+    const size_t num_points = scandata.distance_data.size();
+    if( scandata.headers.empty() )
+        return;
 
-    // Erase packet from ring buffer
-    ring_buffer_.erase_begin(p->header.packet_size);
+    const vector<SectorSubscription>& subscriptions = *open.sector_subscriptions;
+    for( size_t i=0; i<subscriptions.size(); i++ )
+    {
+        const size_t sector_size = open.sector_sizes[i];
+        vector<uint64_t>& emitted = open.emitted_sectors[i];
+
+        // Sectors overlapping [first_index, end_index)
+        for( size_t first = (first_index/sector_size)*sector_size; first < end_index && first < num_points; first += sector_size )
+        {
+            const size_t last = min(first+sector_size,num_points);
+            const size_t sector_bit = first/sector_size;
+            const uint64_t sector_flag = uint64_t(1) << (sector_bit%64);
+            if( emitted[sector_bit/64] & sector_flag )
+                continue;
+            if( !force && !hasPackets(open,first,last) )
+                continue;
+            emitted[sector_bit/64] |= sector_flag;
+
+            // Angle and timestamp from the packet containing the first point, or the closest one before
+            const PacketHeader* ref = &scandata.headers[0];
+            for( const auto& h : scandata.headers )
+            {
+                if( h.first_index <= first && ( ref->first_index > first || h.first_index > ref->first_index ) )
+                    ref = &h;
+            }
+
+            ScanSector sector;
+            sector.scan = &scandata;
+            sector.scan_number = open.scan_number;
+            sector.first_index = first;
+            sector.num_points = last-first;
+            sector.angular_increment = ref->angular_increment;
+            sector.first_angle = ref->first_angle + ((int32_t) first - (int32_t) ref->first_index)*ref->angular_increment;
+            sector.timestamp_raw = ref->timestamp_raw;
+            sector.host_timestamp = getPointHostTime(*ref,first);
+            subscriptions[i].callback(sector);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+bool DataReceiver::hasPackets(const OpenScan &open, size_t first_index, size_t end_index)
+{
+    // All packets but the last one hold points_per_packet points
+    for( size_t packet_bit = first_index/open.points_per_packet; packet_bit <= (end_index-1)/open.points_per_packet; packet_bit++ )
+    {
+        if( packet_bit/64 >= open.received_packets.size() ||
+            !(open.received_packets[packet_bit/64] & (uint64_t(1) << (packet_bit%64))) )
+            return false;
+    }
     return true;
 }
 
+//-----------------------------------------------------------------------------
+int64_t DataReceiver::getPointHostTime(const PacketHeader &header, size_t index) const
+{
+    // The timestamp belongs to the first point of the packet, points are measured at a constant rate
+    const int64_t packet_time = scanner_clock_.toHostTime(header.timestamp_raw);
+    if( header.scan_frequency == 0 || header.num_points_scan == 0 )
+        return packet_time;
+    const double point_duration = 1e12/(double(header.scan_frequency)*header.num_points_scan);
+    return packet_time + int64_t(((int64_t) index - (int64_t) header.first_index)*point_duration);
+}
+
+//-----------------------------------------------------------------------------
+bool DataReceiver::isLateScan(uint16_t scan_number) const
+{
+    // Scan numbers overflow, so compare them by their signed distance
+    const int16_t age = (int16_t) (uint16_t) (last_scan_number_ - scan_number);
+    return has_last_scan_ && age >= 0 && age < 4;
+}
+
+//-----------------------------------------------------------------------------
+int DataReceiver::findPacketStart()
+{
+    const size_t size = ring_buffer_.size();
+    const boost::circular_buffer<char>::array_range one = ring_buffer_.array_one();
+    const boost::circular_buffer<char>::array_range two = ring_buffer_.array_two();
+
+    size_t pos = resync_offset_;
+    while( pos < size )
+    {
+        // Search the first magic byte within the linear span pos is part of
+        const char* span = (pos < one.second) ? one.first+pos : two.first+(pos-one.second);
+        const size_t span_size = (pos < one.second) ? one.second-pos : size-pos;
+        const char* hit = (const char*) memchr(span,0x5c,span_size);
+        if( !hit )
+        {
+            pos += span_size;
+            continue;
+        }
+        pos += hit-span;
+
+        // Magic bytes may be incomplete yet
+        if( pos+4 > size )
+            break;
+
+        // Check remaining magic bytes, possibly crossing the span boundary
+        if(   ((unsigned char) ring_buffer_[pos+1]) == 0xa2
+           && payloadPointSize((unsigned char) ring_buffer_[pos+2]) > 0
+           && ((unsigned char) ring_buffer_[pos+3]) == 0x00 )
+        {
+            resync_offset_ = pos;
+            return pos;
+        }
+        pos++;
+    }
+    resync_offset_ = min(pos,size);
+    return -1;
+}
+
 //-----------------------------------------------------------------------------
 void DataReceiver::disconnect()
 {
     is_connected_ = false;
+    scan_queue_.notify();
     try
     {
-        if( udp_socket_ )
-            udp_socket_->close();
-        io_service_.stop();
-        if( boost::this_thread::get_id() != io_service_thread_.get_id() )
-            io_service_thread_.join();
+        if( owns_io_service_ )
+        {
+            closeSockets();
+            io_service_->stop();
+            if( boost::this_thread::get_id() != io_service_thread_.get_id() )
+                io_service_thread_.join();
+        }
+        else
+        {
+            // Socket handlers run with the guard locked, so the sockets can be closed from any thread
+            // without waiting for the shared io_service: from a handler of this receiver (the mutex is
+            // recursive), from any other handler on the shared IO threads, or after the io_service stopped
+            lock_guard<recursive_mutex> lock(handler_guard_->mutex);
+            closeSockets();
+        }
     }
     catch (exception& e)
     {
@@ -175,12 +960,23 @@ void DataReceiver::disconnect()
     }
 }
 
+//-----------------------------------------------------------------------------
+void DataReceiver::closeSockets()
+{
+    boost::system::error_code ignored;
+    if( udp_socket_ )
+        udp_socket_->close(ignored);
+    if( tcp_socket_ )
+        tcp_socket_->close(ignored);
+}
+
 //-----------------------------------------------------------------------------
 bool DataReceiver::checkConnection()
 {
     if( !isConnected() )
         return false;
-    if( (time(0)-last_data_time_) > 2 )
+    const int64_t timeout = data_timeout_.load(memory_order_relaxed);
+    if( timeout > 0 && monotonicNanoseconds()-last_data_time_ > timeout )
     {
         disconnect();
         return false;
@@ -191,18 +987,94 @@ bool DataReceiver::checkConnection()
 //-----------------------------------------------------------------------------
 ScanData DataReceiver::getFullScan()
 {
-    unique_lock<mutex> lock(data_mutex_);
-    while( checkConnection() && isConnected() && scan_data_.size()<2 )
-    {
-        data_notifier_.wait_for(lock, chrono::seconds(1));
-    }
     ScanData data;
-    if( scan_data_.size() >= 2 && isConnected() )
+    while( checkConnection() && isConnected() )
     {
-        data = ScanData(move(scan_data_.front()));
-        scan_data_.pop_front();
+        if( scan_queue_.waitPop(data,1000) )
+        {
+            stat_delivery_latency_.record(monotonicNanoseconds()-data.receive_timestamp);
+            return data;
+        }
     }
-    return data;
+
+    // Scans completed before the disconnect are still handed out, e.g. at the end of a replay
+    if( scan_queue_.pop(data) )
+        return data;
+    return ScanData();
+}
+
+//-----------------------------------------------------------------------------
+void DataReceiver::releaseScan(ScanData&& scan)
+{
+    ScanData recycled(move(scan));
+    recycled.distance_data.clear();
+    recycled.amplitude_data.clear();
+    recycled.valid_mask.clear();
+    recycled.headers.clear();
+
+    // If enough buffers are waiting already, this one is simply freed
+    free_scans_.push(recycled);
+}
+
+//-----------------------------------------------------------------------------
+void DataReceiver::setScanSubscriptions(const vector<ScanSubscription> &subscriptions)
+{
+    shared_ptr< const vector<ScanSubscription> > new_subscriptions = make_shared< const vector<ScanSubscription> >(subscriptions);
+    lock_guard<mutex> lock(subscription_mutex_);
+    scan_subscriptions_ = new_subscriptions;
+}
+
+//-----------------------------------------------------------------------------
+void DataReceiver::setSectorSubscriptions(const vector<SectorSubscription> &subscriptions)
+{
+    shared_ptr< const vector<SectorSubscription> > new_subscriptions = make_shared< const vector<SectorSubscription> >(subscriptions);
+    lock_guard<mutex> lock(subscription_mutex_);
+    sector_subscriptions_ = new_subscriptions;
+}
+
+//-----------------------------------------------------------------------------
+void DataReceiver::setRecorder(const shared_ptr<PacketRecorder> &recorder)
+{
+    // The IO thread feeds the recorder with the lock held, so the previous one is not fed anymore afterwards
+    lock_guard<mutex> lock(recorder_mutex_);
+    recorder_ = recorder;
+    is_recording_.store(recorder_ != 0,memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+void DataReceiver::recordData(const char *data, size_t size, int64_t timestamp)
+{
+    lock_guard<mutex> lock(recorder_mutex_);
+    if( recorder_ )
+        recorder_->record(data,size,timestamp);
+}
+
+//-----------------------------------------------------------------------------
+ReceiverStats DataReceiver::getStats() const
+{
+    ReceiverStats stats;
+    stats.receive_mode = receive_mode_;
+    stats.datagrams = stat_datagrams_.load(memory_order_relaxed);
+    stats.datagrams_truncated = stat_datagrams_truncated_.load(memory_order_relaxed);
+    stats.datagrams_invalid = stat_datagrams_invalid_.load(memory_order_relaxed);
+    stats.wakeups = stat_wakeups_.load(memory_order_relaxed);
+    stats.bytes = stat_bytes_.load(memory_order_relaxed);
+    stats.packets = stat_packets_.load(memory_order_relaxed);
+    stats.scans_completed = stat_scans_completed_.load(memory_order_relaxed);
+    stats.scans_incomplete = stat_scans_incomplete_.load(memory_order_relaxed);
+    stats.scans_dropped = stat_scans_dropped_.load(memory_order_relaxed);
+    stats.producer_blocks = stat_producer_blocks_.load(memory_order_relaxed);
+    stats.queue_high_water = stat_queue_high_water_.load(memory_order_relaxed);
+    stats.resyncs = stat_resyncs_.load(memory_order_relaxed);
+    stats.skipped_bytes = stat_skipped_bytes_.load(memory_order_relaxed);
+    stats.kernel_drops = stat_kernel_drops_.load(memory_order_relaxed);
+    stats.clock_offset_ns = stat_clock_offset_.load(memory_order_relaxed);
+    stats.clock_drift_ppm = stat_clock_drift_.load(memory_order_relaxed);
+    stats.stack_latency_ns = stat_stack_latency_.load(memory_order_relaxed);
+    stats.transfer_latency_ns = stat_transfer_latency_.load(memory_order_relaxed);
+    stats.parse_time = stat_parse_time_.snapshot();
+    stats.delivery_latency = stat_delivery_latency_.snapshot();
+    return stats;
 }
 
 //-----------------------------------------------------------------------------
@@ -0,0 +1,416 @@
+#include <json_reader.h>
+#include <cstring>
+#include <climits>
+using namespace std;
+
+namespace pepperl_fuchs {
+
+//-----------------------------------------------------------------------------
+//! Value of a hexadecimal digit, -1 if it is none
+static int hexValue(char c)
+{
+    if( c >= '0' && c <= '9' )
+        return c - '0';
+    if( c >= 'a' && c <= 'f' )
+        return c - 'a' + 10;
+    if( c >= 'A' && c <= 'F' )
+        return c - 'A' + 10;
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+//! Read the 4 hex digits of a \u escape sequence
+static unsigned int readCodeUnit(const char* p)
+{
+    unsigned int value = 0;
+    for( int i=0; i<4; i++ )
+        value = (value << 4) | hexValue(p[i]);
+    return value;
+}
+
+//-----------------------------------------------------------------------------
+//! Append a code point encoded as UTF-8
+static void appendUtf8(string& out, unsigned int cp)
+{
+    if( cp < 0x80 )
+        out += char(cp);
+    else if( cp < 0x800 )
+    {
+        out += char(0xC0 | (cp >> 6));
+        out += char(0x80 | (cp & 0x3F));
+    }
+    else if( cp < 0x10000 )
+    {
+        out += char(0xE0 | (cp >> 12));
+        out += char(0x80 | ((cp >> 6) & 0x3F));
+        out += char(0x80 | (cp & 0x3F));
+    }
+    else
+    {
+        out += char(0xF0 | (cp >> 18));
+        out += char(0x80 | ((cp >> 12) & 0x3F));
+        out += char(0x80 | ((cp >> 6) & 0x3F));
+        out += char(0x80 | (cp & 0x3F));
+    }
+}
+
+//-----------------------------------------------------------------------------
+bool JsonToken::equals(const char *str, size_t length) const
+{
+    if( !escaped )
+        return size == length && memcmp(data,str,length) == 0;
+    const string text = this->str();
+    return text.size() == length && memcmp(text.data(),str,length) == 0;
+}
+
+//-----------------------------------------------------------------------------
+string JsonToken::str() const
+{
+    if( !escaped )
+        return string(data,size);
+    string out;
+    appendTo(out);
+    return out;
+}
+
+//-----------------------------------------------------------------------------
+void JsonToken::appendTo(string &out) const
+{
+    if( !escaped )
+    {
+        out.append(data,size);
+        return;
+    }
+
+    // Escape sequences have been validated by the parser
+    const char* end = data + size;
+    for( const char* p = data; p < end; p++ )
+    {
+        if( *p != '\\' )
+        {
+            const char* plain = p;
+            while( p < end && *p != '\\' )
+                p++;
+            out.append(plain,p-plain);
+            p--;
+            continue;
+        }
+
+        p++;
+        switch( *p )
+        {
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'u':
+        {
+            unsigned int cp = readCodeUnit(p+1);
+            p += 4;
+
+            // Characters beyond the basic plane are written as surrogate pair
+            if( cp >= 0xD800 && cp < 0xDC00 && end-p > 6 && p[1] == '\\' && p[2] == 'u' )
+            {
+                const unsigned int low = readCodeUnit(p+3);
+                if( low >= 0xDC00 && low < 0xE000 )
+                {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    p += 6;
+                }
+            }
+            appendUtf8(out,cp);
+            break;
+        }
+        default: out += *p; break;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+boost::optional<long long> JsonToken::toInteger() const
+{
+    const char* p = data;
+    const char* end = data + size;
+    const bool negative = ( p < end && *p == '-' );
+    if( negative )
+        p++;
+    if( p == end )
+        return boost::optional<long long>();
+
+    long long value = 0;
+    for( ; p < end; p++ )
+    {
+        if( *p < '0' || *p > '9' || value > (LLONG_MAX - 9) / 10 )
+            return boost::optional<long long>();
+        value = value*10 + (*p - '0');
+    }
+    return negative ? -value : value;
+}
+
+//-----------------------------------------------------------------------------
+bool JsonReader::parse(const char *data, size_t size)
+{
+    begin_ = data;
+    end_ = data + size;
+    pos_ = data;
+    members_.clear();
+    elements_.clear();
+
+    skipWhitespace();
+    if( pos_ == end_ || *pos_ != '{' )
+        return fail("Expected object");
+    pos_++;
+    skipWhitespace();
+
+    if( pos_ < end_ && *pos_ == '}' )
+        pos_++;
+    else
+    {
+        while( true )
+        {
+            Member member;
+            skipWhitespace();
+            if( pos_ == end_ || *pos_ != '"' || !parseString(member.name) )
+                return fail("Expected member name");
+            skipWhitespace();
+            if( pos_ == end_ || *pos_ != ':' )
+                return fail("Expected ':'");
+            pos_++;
+            skipWhitespace();
+            if( !parseValue(member) )
+                return false;
+            members_.push_back(member);
+
+            skipWhitespace();
+            if( pos_ == end_ )
+                return fail("Unterminated object");
+            if( *pos_ == '}' )
+            {
+                pos_++;
+                break;
+            }
+            if( *pos_ != ',' )
+                return fail("Expected ',' or '}'");
+            pos_++;
+        }
+    }
+
+    skipWhitespace();
+    if( pos_ != end_ )
+        return fail("Unexpected data after object");
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool JsonReader::parseValue(Member &member)
+{
+    member.is_string = false;
+    member.is_array = false;
+    member.first_element = elements_.size();
+    member.num_elements = 0;
+
+    if( pos_ == end_ )
+        return fail("Expected value");
+
+    if( *pos_ == '"' )
+    {
+        member.is_string = true;
+        return parseString(member.value);
+    }
+
+    if( *pos_ == '{' )
+    {
+        const char* start = pos_;
+        if( !skipNested() )
+            return false;
+        member.value.data = start;
+        member.value.size = pos_ - start;
+        member.value.escaped = false;
+        return true;
+    }
+
+    if( *pos_ != '[' )
+        return parseScalar(member.value);
+
+    // Array, its scalar elements are recorded in the element list
+    member.is_array = true;
+    const char* start = pos_;
+    pos_++;
+    skipWhitespace();
+    if( pos_ < end_ && *pos_ == ']' )
+        pos_++;
+    else
+    {
+        while( true )
+        {
+            skipWhitespace();
+            if( pos_ == end_ )
+                return fail("Unterminated array");
+            if( *pos_ == '{' || *pos_ == '[' )
+            {
+                if( !skipNested() )
+                    return false;
+            }
+            else
+            {
+                JsonToken element;
+                if( !( *pos_ == '"' ? parseString(element) : parseScalar(element) ) )
+                    return false;
+                elements_.push_back(element);
+                member.num_elements++;
+            }
+
+            skipWhitespace();
+            if( pos_ == end_ )
+                return fail("Unterminated array");
+            if( *pos_ == ']' )
+            {
+                pos_++;
+                break;
+            }
+            if( *pos_ != ',' )
+                return fail("Expected ',' or ']'");
+            pos_++;
+        }
+    }
+    member.value.data = start + 1;
+    member.value.size = pos_ - start - 2;
+    member.value.escaped = false;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool JsonReader::parseString(JsonToken &token)
+{
+    pos_++;
+    token.data = pos_;
+    token.escaped = false;
+    while( pos_ < end_ && *pos_ != '"' )
+    {
+        if( *pos_ == '\\' )
+        {
+            token.escaped = true;
+            if( ++pos_ == end_ )
+                break;
+            if( *pos_ == 'u' )
+            {
+                if( end_ - pos_ < 5 || hexValue(pos_[1]) < 0 || hexValue(pos_[2]) < 0 || hexValue(pos_[3]) < 0 || hexValue(pos_[4]) < 0 )
+                    return fail("Invalid escape sequence");
+                pos_ += 4;
+            }
+            else if( !strchr("\"\\/bfnrt",*pos_) )
+                return fail("Invalid escape sequence");
+        }
+        pos_++;
+    }
+    if( pos_ == end_ )
+        return fail("Unterminated string");
+    token.size = pos_ - token.data;
+    pos_++;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool JsonReader::parseScalar(JsonToken &token)
+{
+    token.data = pos_;
+    token.escaped = false;
+    while( pos_ < end_ && *pos_ != ',' && *pos_ != '}' && *pos_ != ']'
+           && *pos_ != ' ' && *pos_ != '\t' && *pos_ != '\r' && *pos_ != '\n' )
+        pos_++;
+    token.size = pos_ - token.data;
+    if( token.size == 0 )
+        return fail("Expected value");
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool JsonReader::skipNested()
+{
+    int depth = 0;
+    while( pos_ < end_ )
+    {
+        if( *pos_ == '"' )
+        {
+            JsonToken ignored;
+            if( !parseString(ignored) )
+                return false;
+            continue;
+        }
+        if( *pos_ == '{' || *pos_ == '[' )
+            depth++;
+        else if( *pos_ == '}' || *pos_ == ']' )
+            depth--;
+        pos_++;
+        if( depth == 0 )
+            return true;
+    }
+    return fail("Unterminated object or array");
+}
+
+//-----------------------------------------------------------------------------
+void JsonReader::skipWhitespace()
+{
+    while( pos_ < end_ && ( *pos_ == ' ' || *pos_ == '\t' || *pos_ == '\r' || *pos_ == '\n' ) )
+        pos_++;
+}
+
+//-----------------------------------------------------------------------------
+bool JsonReader::fail(const char *message)
+{
+    error_ = string(message) + " at offset " + to_string(pos_ - begin_);
+    members_.clear();
+    elements_.clear();
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+size_t JsonReader::find(const string &name, size_t hint) const
+{
+    // Names are usually requested in the order of the data, so the search starts at the hint
+    const size_t num_members = members_.size();
+    for( size_t i=0; i<num_members; i++ )
+    {
+        const size_t index = (hint + i) % num_members;
+        if( members_[index].name.equals(name.data(),name.size()) )
+            return index;
+    }
+    return num_members;
+}
+
+//-----------------------------------------------------------------------------
+boost::optional<string> JsonReader::getString(const string &name) const
+{
+    const size_t index = find(name);
+    if( index == members_.size() || members_[index].is_array || (!members_[index].is_string && members_[index].value.data[0] == '{') )
+        return boost::optional<string>();
+    return members_[index].value.str();
+}
+
+//-----------------------------------------------------------------------------
+boost::optional<int> JsonReader::getInt(const string &name) const
+{
+    const size_t index = find(name);
+    if( index == members_.size() || members_[index].is_array || members_[index].value.escaped )
+        return boost::optional<int>();
+    boost::optional<long long> value = members_[index].value.toInteger();
+    if( !value || *value < INT_MIN || *value > INT_MAX )
+        return boost::optional<int>();
+    return int(*value);
+}
+
+//-----------------------------------------------------------------------------
+bool JsonReader::getStringArray(const string &name, vector<string> &values) const
+{
+    const size_t index = find(name);
+    if( index == members_.size() || !members_[index].is_array )
+        return false;
+    const Member& member = members_[index];
+    values.reserve(values.size() + member.num_elements);
+    for( size_t i=0; i<member.num_elements; i++ )
+        values.push_back(elements_[member.first_element+i].str());
+    return true;
+}
+
+}
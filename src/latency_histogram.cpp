@@ -0,0 +1,79 @@
+#include <latency_histogram.h>
+#include <algorithm>
+using namespace std;
+
+namespace pepperl_fuchs {
+
+//-----------------------------------------------------------------------------
+size_t LatencyHistogram::bucketIndex(uint64_t ns)
+{
+    if( ns < SUB_BUCKETS )
+        return ns;
+
+    // Power of two and the two bits below the leading one
+    const size_t exponent = 63 - __builtin_clzll(ns);
+    const size_t sub_bucket = (ns >> (exponent-2)) & (SUB_BUCKETS-1);
+    return (exponent-1)*SUB_BUCKETS + sub_bucket;
+}
+
+//-----------------------------------------------------------------------------
+uint64_t LatencyHistogram::bucketLowerBound(size_t index)
+{
+    if( index < SUB_BUCKETS )
+        return index;
+    const size_t exponent = index/SUB_BUCKETS + 1;
+    return uint64_t(SUB_BUCKETS + index%SUB_BUCKETS) << (exponent-2);
+}
+
+//-----------------------------------------------------------------------------
+uint64_t LatencyHistogram::percentile(double fraction) const
+{
+    if( count == 0 )
+        return 0;
+
+    const uint64_t rank = max(uint64_t(1),uint64_t(fraction*count + 0.5));
+    uint64_t seen = 0;
+    for( size_t i=0; i<NUM_BUCKETS; i++ )
+    {
+        seen += counts[i];
+        if( seen >= rank )
+        {
+            const uint64_t upper = ( i+1 < NUM_BUCKETS ) ? bucketLowerBound(i+1)-1 : ~uint64_t(0);
+            return min(upper,max_ns);
+        }
+    }
+    return max_ns;
+}
+
+//-----------------------------------------------------------------------------
+AtomicHistogram::AtomicHistogram() : count_(0), sum_ns_(0), max_ns_(0)
+{
+    for( auto& bucket : counts_ )
+        bucket.store(0,memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+void AtomicHistogram::record(int64_t ns)
+{
+    const uint64_t value = ( ns > 0 ) ? uint64_t(ns) : 0;
+    counts_[LatencyHistogram::bucketIndex(value)].fetch_add(1,memory_order_relaxed);
+    count_.fetch_add(1,memory_order_relaxed);
+    sum_ns_.fetch_add(value,memory_order_relaxed);
+
+    uint64_t current_max = max_ns_.load(memory_order_relaxed);
+    while( value > current_max && !max_ns_.compare_exchange_weak(current_max,value,memory_order_relaxed) ) {}
+}
+
+//-----------------------------------------------------------------------------
+LatencyHistogram AtomicHistogram::snapshot() const
+{
+    LatencyHistogram histogram;
+    for( size_t i=0; i<LatencyHistogram::NUM_BUCKETS; i++ )
+        histogram.counts[i] = counts_[i].load(memory_order_relaxed);
+    histogram.count = count_.load(memory_order_relaxed);
+    histogram.sum_ns = sum_ns_.load(memory_order_relaxed);
+    histogram.max_ns = max_ns_.load(memory_order_relaxed);
+    return histogram;
+}
+
+}
@@ -0,0 +1,88 @@
+#include <mock_scanner.h>
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <csignal>
+using namespace std;
+using namespace pepperl_fuchs;
+
+//-------------------------------------------------------------------------------
+//! Print the command line options
+static void usage(const char* program)
+{
+    cerr << "Usage: " << program << " [options]" << endl
+         << "  --address ADDRESS         local address to serve on (127.0.0.1)" << endl
+         << "  --port PORT               HTTP port, 0 for a free one (0)" << endl
+         << "  --frequency HZ            scan frequency in Hz (50)" << endl
+         << "  --samples N               points per scan (3600)" << endl
+         << "  --points-per-packet N     points per packet, 0 for the maximum (0)" << endl
+         << "  --loss P                  probability of a packet being lost (0)" << endl
+         << "  --reorder P               probability of a packet being sent after its successor (0)" << endl
+         << "  --corruption P            probability of a packet being corrupted (0)" << endl
+         << "  --seed N                  seed of the fault injection (1)" << endl;
+}
+
+//-------------------------------------------------------------------------------
+//! Emulate a R2000 on the local host until SIGINT or SIGTERM, for tests without hardware
+int main(int argc, char** argv)
+{
+    MockScannerOptions options;
+    for( int i=1; i<argc; i++ )
+    {
+        const string option = argv[i];
+        if( option == "--help" || option == "-h" || i+1 >= argc )
+        {
+            usage(argv[0]);
+            return option == "--help" || option == "-h" ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        const char* value = argv[++i];
+        if( option == "--address" )
+            options.address = value;
+        else if( option == "--port" )
+            options.http_port = atoi(value);
+        else if( option == "--frequency" )
+            options.scan_frequency = (unsigned int) (atof(value)*1000.0 + 0.5);
+        else if( option == "--samples" )
+            options.samples_per_scan = atoi(value);
+        else if( option == "--points-per-packet" )
+            options.points_per_packet = atoi(value);
+        else if( option == "--loss" )
+            options.packet_loss = atof(value);
+        else if( option == "--reorder" )
+            options.packet_reorder = atof(value);
+        else if( option == "--corruption" )
+            options.packet_corruption = atof(value);
+        else if( option == "--seed" )
+            options.seed = atoi(value);
+        else
+        {
+            cerr << "ERROR: Unknown option " << option << endl;
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Block the signals before the mock starts its threads, so only sigwait() receives them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals,SIGINT);
+    sigaddset(&signals,SIGTERM);
+    pthread_sigmask(SIG_BLOCK,&signals,0);
+
+    MockScanner mock(options);
+    if( !mock.isRunning() )
+    {
+        cerr << "ERROR: Could not serve on " << options.address << ":" << options.http_port << endl;
+        return EXIT_FAILURE;
+    }
+    cout << "Emulating a R2000 at " << mock.getAddress() << ":" << mock.getHttpPort() << endl;
+
+    int signal = 0;
+    sigwait(&signals,&signal);
+
+    const MockScannerStats stats = mock.getStats();
+    cout << "Requests " << stats.requests << ", packets sent " << stats.packets_sent
+         << ", lost " << stats.packets_lost << ", reordered " << stats.packets_reordered
+         << ", corrupted " << stats.packets_corrupted << ", watchdog timeouts " << stats.watchdog_timeouts << endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,615 @@
+#include <mock_scanner.h>
+#include <packet_structure.h>
+#include <payload_unpack.h>
+#include <scanner_clock.h>
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+using namespace std;
+
+namespace pepperl_fuchs {
+
+//! Commands listed by get_protocol_info
+static const char* const MOCK_COMMANDS[] = { "get_protocol_info", "list_parameters", "get_parameter", "set_parameter",
+                                             "reset_parameter", "request_handle_udp", "release_handle", "start_scanoutput",
+                                             "stop_scanoutput", "feed_watchdog", "reboot_device" };
+
+//! Parameters listed by list_parameters
+static const char* const MOCK_PARAMETERS[] = { "vendor", "product", "part", "serial", "revision_fw", "revision_hw",
+                                               "max_connections", "radial_range_min", "radial_range_max", "radial_resolution",
+                                               "angular_fov", "angular_resolution", "scan_frequency_min", "scan_frequency_max",
+                                               "sampling_rate_min", "sampling_rate_max", "up_time", "status_flags",
+                                               "operating_mode", "scan_direction", "scan_frequency", "samples_per_scan",
+                                               "scan_frequency_measured", "user_tag", "user_notes" };
+
+//-----------------------------------------------------------------------------
+//! Decode %XX escapes and '+' of a query string component
+static string urlDecode(const string& value)
+{
+    string out;
+    out.reserve(value.size());
+    for( size_t i=0; i<value.size(); i++ )
+    {
+        if( value[i] == '%' && i+2 < value.size() )
+        {
+            out += char(strtol(value.substr(i+1,2).c_str(),0,16));
+            i += 2;
+        }
+        else if( value[i] == '+' )
+            out += ' ';
+        else
+            out += value[i];
+    }
+    return out;
+}
+
+//-----------------------------------------------------------------------------
+//! Split a string at the given separator, dropping empty parts
+static vector<string> splitList(const string& value, char separator)
+{
+    vector<string> parts;
+    stringstream ss(value);
+    string part;
+    while( getline(ss,part,separator) )
+        if( !part.empty() )
+            parts.push_back(part);
+    return parts;
+}
+
+//-----------------------------------------------------------------------------
+MockScanner::MockScanner(const MockScannerOptions &options):options_(options),acceptor_(io_service_),udp_socket_(io_service_)
+{
+    packet_loss_ = options.packet_loss;
+    packet_reorder_ = options.packet_reorder;
+    packet_corruption_ = options.packet_corruption;
+    http_port_ = 0;
+    is_running_ = false;
+    next_handle_ = 1;
+    scan_frequency_ = options.scan_frequency;
+    samples_per_scan_ = min(max(options.samples_per_scan,1u),65535u);
+    start_time_ = monotonicNanoseconds();
+    random_.seed(options.seed);
+    scan_number_ = 0;
+    packet_number_ = 0;
+    scan_samples_ = 0;
+    running_ = false;
+    stat_requests_ = 0;
+    stat_packets_sent_ = 0;
+    stat_packets_lost_ = 0;
+    stat_packets_reordered_ = 0;
+    stat_packets_corrupted_ = 0;
+    stat_watchdog_timeouts_ = 0;
+
+    try
+    {
+        using boost::asio::ip::tcp;
+        using boost::asio::ip::udp;
+        const boost::asio::ip::address address = boost::asio::ip::address::from_string(options_.address);
+        tcp::endpoint endpoint(address,options_.http_port);
+        acceptor_.open(endpoint.protocol());
+        acceptor_.set_option(tcp::acceptor::reuse_address(true));
+        acceptor_.bind(endpoint);
+        acceptor_.listen();
+        http_port_ = acceptor_.local_endpoint().port();
+
+        udp_socket_.open(address.is_v6() ? udp::v6() : udp::v4());
+        udp_socket_.bind(udp::endpoint(address,0));
+        udp_socket_.non_blocking(true);
+    }
+    catch (std::exception& e)
+    {
+        cerr << "ERROR: Mock scanner could not listen on " << options_.address << ":" << options_.http_port << ": " << e.what() << endl;
+        return;
+    }
+
+    is_running_ = true;
+    startAccept();
+    io_service_thread_ = boost::thread(boost::bind(&boost::asio::io_service::run, &io_service_));
+    running_ = true;
+    sender_thread_ = thread(&MockScanner::senderLoop,this);
+}
+
+//-----------------------------------------------------------------------------
+MockScanner::~MockScanner()
+{
+    running_ = false;
+    if( sender_thread_.joinable() )
+        sender_thread_.join();
+    io_service_.stop();
+    if( io_service_thread_.joinable() )
+        io_service_thread_.join();
+}
+
+//-----------------------------------------------------------------------------
+void MockScanner::setFaults(double packet_loss, double packet_reorder, double packet_corruption)
+{
+    packet_loss_ = packet_loss;
+    packet_reorder_ = packet_reorder;
+    packet_corruption_ = packet_corruption;
+}
+
+//-----------------------------------------------------------------------------
+MockScannerStats MockScanner::getStats() const
+{
+    MockScannerStats stats;
+    stats.requests = stat_requests_;
+    stats.packets_sent = stat_packets_sent_;
+    stats.packets_lost = stat_packets_lost_;
+    stats.packets_reordered = stat_packets_reordered_;
+    stats.packets_corrupted = stat_packets_corrupted_;
+    stats.watchdog_timeouts = stat_watchdog_timeouts_;
+    return stats;
+}
+
+//-----------------------------------------------------------------------------
+void MockScanner::startAccept()
+{
+    shared_ptr<boost::asio::ip::tcp::socket> socket = make_shared<boost::asio::ip::tcp::socket>(io_service_);
+    acceptor_.async_accept(*socket,[this,socket](const boost::system::error_code& error)
+    {
+        if( error )
+            return;
+        boost::system::error_code ignored;
+        socket->set_option(boost::asio::ip::tcp::no_delay(true),ignored);
+        serveConnection(socket,make_shared<boost::asio::streambuf>());
+        startAccept();
+    });
+}
+
+//-----------------------------------------------------------------------------
+void MockScanner::serveConnection(shared_ptr<boost::asio::ip::tcp::socket> socket, shared_ptr<boost::asio::streambuf> buffer)
+{
+    // Requests are answered in order, pipelined ones wait in the buffer
+    boost::asio::async_read_until(*socket,*buffer,"\r\n\r\n",[this,socket,buffer](const boost::system::error_code& error, size_t header_size)
+    {
+        if( error )
+            return;
+
+        const char* data = boost::asio::buffer_cast<const char*>(buffer->data());
+        istringstream request_stream(string(data,header_size));
+        buffer->consume(header_size);
+        string method, target, http_version;
+        request_stream >> method >> target >> http_version;
+
+        // HTTP/1.1 keeps the connection unless asked otherwise, HTTP/1.0 closes it unless asked otherwise
+        bool keep_alive = ( http_version == "HTTP/1.1" );
+        string line;
+        while( getline(request_stream,line) && line != "\r" )
+        {
+            for( size_t i=0; i<line.size(); i++ )
+                line[i] = tolower(line[i]);
+            if( line.compare(0,11,"connection:") == 0 )
+                keep_alive = ( line.find("keep-alive") != string::npos || (keep_alive && line.find("close") == string::npos) );
+        }
+
+        HttpResponse response;
+        if( method != "GET" )
+        {
+            response.status = 405;
+            response.body = jsonResponse(ERROR_UNKNOWN_ARGUMENT);
+        }
+        else
+            response = handleCommand(target);
+        stat_requests_++;
+
+        const char* reason = response.status == 200 ? "OK" : response.status == 404 ? "Not Found" : "Error";
+        shared_ptr<string> reply = make_shared<string>(
+                    "HTTP/1.1 " + to_string(response.status) + " " + reason + "\r\n"
+                    "Content-Type: application/json\r\n"
+                    "Content-Length: " + to_string(response.body.size()) + "\r\n"
+                    "Connection: " + (keep_alive ? "keep-alive" : "close") + "\r\n\r\n" + response.body);
+        boost::asio::async_write(*socket,boost::asio::buffer(*reply),[this,socket,buffer,reply,keep_alive](const boost::system::error_code& write_error, size_t)
+        {
+            if( !write_error && keep_alive )
+                serveConnection(socket,buffer);
+        });
+    });
+}
+
+//-----------------------------------------------------------------------------
+MockScanner::HttpResponse MockScanner::handleCommand(const string &target)
+{
+    HttpResponse response;
+    response.status = 200;
+
+    // Split "/cmd/<command>?<key>=<value>&..."
+    const size_t query_start = target.find('?');
+    const string path = target.substr(0,query_start);
+    if( path.compare(0,5,"/cmd/") != 0 )
+    {
+        response.status = 404;
+        return response;
+    }
+    const string cmd = path.substr(5);
+    vector< pair<string,string> > args;
+    if( query_start != string::npos )
+    {
+        for( const auto& arg: splitList(target.substr(query_start+1),'&') )
+        {
+            const size_t eq = arg.find('=');
+            args.push_back(make_pair(urlDecode(arg.substr(0,eq)),eq == string::npos ? string() : urlDecode(arg.substr(eq+1))));
+        }
+    }
+    map<string,string> arg_map(args.begin(),args.end());
+
+    lock_guard<mutex> lock(params_mutex_);
+    if( cmd == "get_protocol_info" )
+    {
+        string commands;
+        for( auto c: MOCK_COMMANDS )
+            commands += (commands.empty() ? "" : ",") + jsonString(c);
+        response.body = jsonResponse(ERROR_SUCCESS,"\"protocol_name\":\"pfsdp\",\"version_major\":1,\"version_minor\":3,\"commands\":[" + commands + "]");
+    }
+    else if( cmd == "list_parameters" )
+    {
+        string parameters;
+        for( auto p: MOCK_PARAMETERS )
+            parameters += (parameters.empty() ? "" : ",") + jsonString(p);
+        response.body = jsonResponse(ERROR_SUCCESS,"\"parameters\":[" + parameters + "]");
+    }
+    else if( cmd == "get_parameter" )
+    {
+        vector<string> names;
+        if( arg_map.count("list") )
+            names = splitList(arg_map["list"],';');
+        else
+            names.assign(begin(MOCK_PARAMETERS),end(MOCK_PARAMETERS));
+        string members;
+        for( const auto& name: names )
+        {
+            const string value = parameterValue(name);
+            if( value.empty() )
+            {
+                response.body = jsonResponse(ERROR_UNKNOWN_PARAMETER);
+                return response;
+            }
+            members += jsonString(name) + ":" + value + ",";
+        }
+        members.erase(members.empty() ? 0 : members.size()-1);
+        response.body = jsonResponse(ERROR_SUCCESS,members);
+    }
+    else if( cmd == "set_parameter" || cmd == "reset_parameter" )
+    {
+        // Without a list, reset_parameter resets all writable parameters
+        vector< pair<string,string> > values = args;
+        if( cmd == "reset_parameter" )
+        {
+            const vector<string> names = arg_map.count("list") ? splitList(arg_map["list"],';') : vector<string> { "scan_frequency", "samples_per_scan", "user_tag", "user_notes" };
+            values.clear();
+            for( const auto& name: names )
+                values.push_back(make_pair(name,string()));
+        }
+
+        int error_code = ERROR_SUCCESS;
+        for( const auto& kv: values )
+        {
+            const bool reset = ( cmd == "reset_parameter" );
+            const long long number = atoll(kv.second.c_str());
+            if( kv.first == "scan_frequency" )
+            {
+                if( !reset && (number < 1 || number > 1000000) )
+                    error_code = ERROR_OUT_OF_RANGE;
+                else
+                    scan_frequency_ = reset ? options_.scan_frequency : unsigned(number*1000);
+            }
+            else if( kv.first == "samples_per_scan" )
+            {
+                if( !reset && (number < 72 || number > 65535) )
+                    error_code = ERROR_OUT_OF_RANGE;
+                else
+                    samples_per_scan_ = reset ? min(max(options_.samples_per_scan,1u),65535u) : unsigned(number);
+            }
+            else if( kv.first == "user_tag" || kv.first == "user_notes" )
+                user_parameters_[kv.first] = kv.second;
+            else if( !parameterValue(kv.first).empty() )
+                error_code = ERROR_READ_ONLY;
+            else
+                error_code = ERROR_UNKNOWN_PARAMETER;
+        }
+        response.body = jsonResponse(error_code);
+    }
+    else if( cmd == "request_handle_udp" )
+    {
+        if( !arg_map.count("address") || !arg_map.count("port") )
+        {
+            response.body = jsonResponse(ERROR_ARGUMENT_MISSING);
+            return response;
+        }
+
+        boost::system::error_code error;
+        const boost::asio::ip::address address = boost::asio::ip::address::from_string(arg_map["address"],error);
+        const int port = atoi(arg_map["port"].c_str());
+        const string packet_type = arg_map.count("packet_type") ? arg_map["packet_type"] : "A";
+        const int start_angle = arg_map.count("start_angle") ? atoi(arg_map["start_angle"].c_str()) : -1800000;
+        if( error || port <= 0 || port > 65535 || packet_type != "C" || start_angle < -1800000 || start_angle > 1800000 )
+        {
+            response.body = jsonResponse(ERROR_INVALID_VALUE);
+            return response;
+        }
+
+        Handle handle;
+        handle.endpoint = boost::asio::ip::udp::endpoint(address,port);
+        handle.start_angle = start_angle;
+        handle.watchdog_enabled = !arg_map.count("watchdog") || arg_map["watchdog"] != "off";
+        handle.watchdog_timeout_ns = int64_t(arg_map.count("watchdogtimeout") ? atoi(arg_map["watchdogtimeout"].c_str()) : 60000) * 1000000;
+        handle.last_feed_time = monotonicNanoseconds();
+        handle.scan_output = false;
+        const string name = "s" + to_string(next_handle_++);
+        handles_[name] = handle;
+        response.body = jsonResponse(ERROR_SUCCESS,"\"handle\":" + jsonString(name) + ",\"port\":" + to_string(port));
+    }
+    else if( cmd == "release_handle" || cmd == "start_scanoutput" || cmd == "stop_scanoutput" || cmd == "feed_watchdog" )
+    {
+        auto handle = handles_.find(arg_map["handle"]);
+        if( handle == handles_.end() )
+        {
+            response.body = jsonResponse(ERROR_INVALID_HANDLE);
+            return response;
+        }
+
+        if( cmd == "release_handle" )
+            handles_.erase(handle);
+        else if( cmd == "start_scanoutput" )
+            handle->second.scan_output = true;
+        else if( cmd == "stop_scanoutput" )
+            handle->second.scan_output = false;
+        if( cmd != "release_handle" )
+            handle->second.last_feed_time = monotonicNanoseconds();
+        response.body = jsonResponse(ERROR_SUCCESS);
+    }
+    else if( cmd == "reboot_device" )
+    {
+        handles_.clear();
+        user_parameters_.clear();
+        scan_frequency_ = options_.scan_frequency;
+        samples_per_scan_ = min(max(options_.samples_per_scan,1u),65535u);
+        response.body = jsonResponse(ERROR_SUCCESS);
+    }
+    else
+    {
+        response.status = 404;
+        response.body = jsonResponse(ERROR_UNKNOWN_ARGUMENT);
+    }
+    return response;
+}
+
+//-----------------------------------------------------------------------------
+string MockScanner::jsonResponse(int error_code, const string &members)
+{
+    const char* error_text = "success";
+    switch( error_code )
+    {
+    case ERROR_SUCCESS: break;
+    case ERROR_UNKNOWN_ARGUMENT: error_text = "Unknown argument"; break;
+    case ERROR_UNKNOWN_PARAMETER: error_text = "Unknown parameter"; break;
+    case ERROR_INVALID_HANDLE: error_text = "Invalid handle or no handle provided"; break;
+    case ERROR_ARGUMENT_MISSING: error_text = "Required argument missing"; break;
+    case ERROR_INVALID_VALUE: error_text = "Invalid value for argument"; break;
+    case ERROR_OUT_OF_RANGE: error_text = "Value for parameter out of range"; break;
+    case ERROR_READ_ONLY: error_text = "Write-access to read-only parameter"; break;
+    default: error_text = "Error"; break;
+    }
+    return "{" + members + (members.empty() ? "" : ",") + "\"error_code\":" + to_string(error_code)
+            + ",\"error_text\":" + jsonString(error_text) + "}";
+}
+
+//-----------------------------------------------------------------------------
+string MockScanner::jsonString(const string &value)
+{
+    string out = "\"";
+    for( char c: value )
+    {
+        if( c == '"' || c == '\\' )
+            out += '\\';
+        if( (unsigned char) c < 0x20 )
+        {
+            char escaped[8];
+            snprintf(escaped,sizeof(escaped),"\\u%04x",c);
+            out += escaped;
+        }
+        else
+            out += c;
+    }
+    return out + "\"";
+}
+
+//-----------------------------------------------------------------------------
+string MockScanner::parameterValue(const string &name) const
+{
+    const unsigned int samples = samples_per_scan_;
+    const unsigned int frequency = scan_frequency_;
+    if( name == "vendor" ) return jsonString("Pepperl+Fuchs");
+    if( name == "product" ) return jsonString("R2000 (mock)");
+    if( name == "part" ) return jsonString("mock");
+    if( name == "serial" ) return jsonString("00000000000000000");
+    if( name == "revision_fw" ) return jsonString("mock");
+    if( name == "revision_hw" ) return jsonString("mock");
+    if( name == "max_connections" ) return "3";
+    if( name == "radial_range_min" ) return "0.1";
+    if( name == "radial_range_max" ) return "30.0";
+    if( name == "radial_resolution" ) return "0.001";
+    if( name == "angular_fov" ) return "360.0";
+    if( name == "angular_resolution" ) return to_string(360.0/samples);
+    if( name == "scan_frequency_min" ) return "1";
+    if( name == "scan_frequency_max" ) return "1000000";
+    if( name == "sampling_rate_min" ) return "1";
+    if( name == "sampling_rate_max" ) return "1000000000";
+    if( name == "up_time" ) return to_string((monotonicNanoseconds()-start_time_)/60000000000ll);
+    if( name == "status_flags" ) return "0";
+    if( name == "operating_mode" ) return jsonString("measure");
+    if( name == "scan_direction" ) return jsonString("ccw");
+    if( name == "scan_frequency" ) return frequency % 1000 ? to_string(frequency/1000.0) : to_string(frequency/1000);
+    if( name == "samples_per_scan" ) return to_string(samples);
+    if( name == "scan_frequency_measured" ) return to_string(frequency/1000.0);
+    if( name == "user_tag" || name == "user_notes" )
+    {
+        auto value = user_parameters_.find(name);
+        return jsonString(value == user_parameters_.end() ? string() : value->second);
+    }
+    return string();
+}
+
+//-----------------------------------------------------------------------------
+void MockScanner::senderLoop()
+{
+    int64_t next_packet_time = monotonicNanoseconds();
+    while( running_ )
+    {
+        const int64_t now = monotonicNanoseconds();
+
+        // Send all packets due, restarting the schedule if the thread fell far behind
+        if( now - next_packet_time > 100000000 )
+            next_packet_time = now;
+        while( running_ && next_packet_time <= now )
+        {
+            sendPacket(next_packet_time);
+            const unsigned int points_per_packet = options_.points_per_packet ? min(options_.points_per_packet,MAX_POINTS_PER_PACKET) : MAX_POINTS_PER_PACKET;
+            const unsigned int packets_per_scan = (scan_samples_ + points_per_packet - 1) / points_per_packet;
+            next_packet_time += int64_t(1e12 / max(scan_frequency_.load(),1u) / packets_per_scan);
+        }
+        checkWatchdogs(now);
+
+        const int64_t sleep_time = min(next_packet_time - monotonicNanoseconds(), int64_t(SENDER_INTERVAL_MS)*1000000);
+        if( sleep_time > 0 )
+            this_thread::sleep_for(chrono::nanoseconds(sleep_time));
+    }
+}
+
+//-----------------------------------------------------------------------------
+void MockScanner::sendPacket(int64_t measure_time)
+{
+    const unsigned int points_per_packet = options_.points_per_packet ? min(options_.points_per_packet,MAX_POINTS_PER_PACKET) : MAX_POINTS_PER_PACKET;
+
+    // Changes of the rotation settings take effect with the next scan
+    if( scan_samples_ == 0 || packet_number_ * points_per_packet >= scan_samples_ )
+    {
+        if( scan_samples_ != 0 )
+            scan_number_++;
+        packet_number_ = 0;
+        if( scan_samples_ != samples_per_scan_ )
+            buildScene(samples_per_scan_);
+    }
+
+    const unsigned int first_index = packet_number_ * points_per_packet;
+    const unsigned int num_points = min(points_per_packet, scan_samples_ - first_index);
+    const int angular_increment = 3600000 / scan_samples_;
+    packet_number_++;
+
+    PacketHeader header;
+    memset(&header,0,sizeof(header));
+    header.magic = 0xa25c;
+    header.packet_type = PACKET_TYPE_C;
+    header.packet_size = sizeof(PacketHeader) + num_points*sizeof(uint32_t);
+    header.header_size = sizeof(PacketHeader);
+    header.scan_number = scan_number_;
+    header.packet_number = packet_number_;
+    const int64_t elapsed = measure_time - start_time_;
+    header.timestamp_raw = (uint64_t(elapsed / 1000000000) << 32) | ((uint64_t(elapsed % 1000000000) << 32) / 1000000000);
+    header.scan_frequency = scan_frequency_;
+    header.num_points_scan = scan_samples_;
+    header.num_points_packet = num_points;
+    header.first_index = first_index;
+    header.angular_increment = angular_increment;
+
+    lock_guard<mutex> lock(params_mutex_);
+    for( auto& h: handles_ )
+    {
+        Handle& handle = h.second;
+        if( !handle.scan_output )
+            continue;
+
+        // The scan starts at the start angle of the handle, the scene is fixed to angle 0
+        int first_angle = handle.start_angle + int(first_index) * angular_increment;
+        while( first_angle >= 1800000 )
+            first_angle -= 3600000;
+        header.first_angle = first_angle;
+        const unsigned int scene_offset = unsigned((handle.start_angle + 3600000) % 3600000 / angular_increment);
+
+        packet_.resize(header.packet_size);
+        memcpy(&packet_[0],&header,sizeof(header));
+        uint32_t* payload = (uint32_t*) &packet_[sizeof(header)];
+        for( unsigned int i=0; i<num_points; i++ )
+            payload[i] = scene_[(scene_offset + first_index + i) % scan_samples_];
+        sendWithFaults(handle);
+    }
+}
+
+//-----------------------------------------------------------------------------
+void MockScanner::checkWatchdogs(int64_t now)
+{
+    lock_guard<mutex> lock(params_mutex_);
+    for( auto handle = handles_.begin(); handle != handles_.end(); )
+    {
+        if( handle->second.watchdog_enabled && now - handle->second.last_feed_time > handle->second.watchdog_timeout_ns )
+        {
+            handle = handles_.erase(handle);
+            stat_watchdog_timeouts_++;
+        }
+        else
+            handle++;
+    }
+}
+
+//-----------------------------------------------------------------------------
+void MockScanner::sendWithFaults(Handle &handle)
+{
+    if( random() < packet_loss_ )
+    {
+        stat_packets_lost_++;
+        return;
+    }
+
+    if( random() < packet_corruption_ )
+    {
+        packet_[size_t(random() * packet_.size())] = char(random_());
+        stat_packets_corrupted_++;
+    }
+
+    // Errors are ignored like packets lost on a real network
+    boost::system::error_code ignored;
+    if( handle.held_packet.empty() && random() < packet_reorder_ )
+    {
+        handle.held_packet.swap(packet_);
+        stat_packets_reordered_++;
+        return;
+    }
+    udp_socket_.send_to(boost::asio::buffer(packet_),handle.endpoint,0,ignored);
+    stat_packets_sent_++;
+    if( !handle.held_packet.empty() )
+    {
+        udp_socket_.send_to(boost::asio::buffer(handle.held_packet),handle.endpoint,0,ignored);
+        handle.held_packet.clear();
+        stat_packets_sent_++;
+    }
+}
+
+//-----------------------------------------------------------------------------
+void MockScanner::buildScene(unsigned int samples)
+{
+    // A rectangular room of 8x6 m with the scanner off center, and a sector without echo
+    scan_samples_ = samples;
+    scene_.resize(samples);
+    for( unsigned int i=0; i<samples; i++ )
+    {
+        const double angle = 2.0 * M_PI * i / samples;
+        const double dx = cos(angle);
+        const double dy = sin(angle);
+        const double to_wall_x = dx > 0 ? 5000.0/dx : dx < 0 ? -3000.0/dx : 1e9;
+        const double to_wall_y = dy > 0 ? 3500.0/dy : dy < 0 ? -2500.0/dy : 1e9;
+        const uint32_t distance = uint32_t(min(to_wall_x,to_wall_y));
+        const uint32_t amplitude = uint32_t(max(4000.0 - distance/2.0, 32.0));
+        const bool echo = ( uint64_t(i)*64/samples != 40 );
+        scene_[i] = echo ? ((amplitude << 20) | (distance & 0x000FFFFF)) : NO_ECHO_DISTANCE;
+    }
+}
+
+//-----------------------------------------------------------------------------
+double MockScanner::random()
+{
+    return uniform_real_distribution<double>(0.0,1.0)(random_);
+}
+
+}
@@ -0,0 +1,219 @@
+#include <packet_recorder.h>
+#include <scanner_clock.h>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <chrono>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+using namespace std;
+
+namespace pepperl_fuchs {
+
+//-----------------------------------------------------------------------------
+PacketRecorder::PacketRecorder(const string &path, const RecorderOptions &options):path_(path),options_(options),
+    buffer_size_(max(options.buffer_size,size_t(65536))),buffer_(new char[buffer_size_])
+{
+    head_ = 0;
+    tail_ = 0;
+    fd_ = -1;
+    file_size_ = 0;
+    file_index_ = 0;
+    file_open_time_ = 0;
+    stat_records_ = 0;
+    stat_bytes_ = 0;
+    stat_dropped_ = 0;
+    stat_files_ = 0;
+    is_open_ = openFile();
+    running_ = true;
+    writer_thread_ = thread(&PacketRecorder::writerLoop,this);
+}
+
+//-----------------------------------------------------------------------------
+PacketRecorder::~PacketRecorder()
+{
+    running_ = false;
+    if( writer_thread_.joinable() )
+        writer_thread_.join();
+    drain();
+    if( fd_ >= 0 )
+        close(fd_);
+}
+
+//-----------------------------------------------------------------------------
+bool PacketRecorder::record(const char *data, size_t size, int64_t timestamp)
+{
+    // Replay rejects larger records as corrupted
+    if( size > CAPTURE_MAX_RECORD_SIZE )
+    {
+        stat_dropped_.fetch_add(1,memory_order_relaxed);
+        return false;
+    }
+
+    const size_t record_size = sizeof(CaptureRecordHeader) + size;
+    const uint64_t head = head_.load(memory_order_relaxed);
+    const uint64_t tail = tail_.load(memory_order_acquire);
+
+    // A record which would wrap around the end of the buffer starts at its beginning instead
+    const size_t offset = head % buffer_size_;
+    const size_t skip = ( offset + record_size > buffer_size_ ) ? buffer_size_ - offset : 0;
+    if( head + skip + record_size - tail > buffer_size_ )
+    {
+        stat_dropped_.fetch_add(1,memory_order_relaxed);
+        return false;
+    }
+    if( skip >= sizeof(CaptureRecordHeader) )
+    {
+        CaptureRecordHeader marker;
+        marker.timestamp = 0;
+        marker.size = WRAP_MARKER;
+        memcpy(&buffer_[offset],&marker,sizeof(marker));
+    }
+
+    CaptureRecordHeader header;
+    header.timestamp = timestamp;
+    header.size = uint32_t(size);
+    char* dst = &buffer_[(head+skip) % buffer_size_];
+    memcpy(dst,&header,sizeof(header));
+    memcpy(dst+sizeof(header),data,size);
+    head_.store(head+skip+record_size,memory_order_release);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+RecorderStats PacketRecorder::getStats() const
+{
+    RecorderStats stats;
+    stats.records = stat_records_.load(memory_order_relaxed);
+    stats.bytes = stat_bytes_.load(memory_order_relaxed);
+    stats.dropped = stat_dropped_.load(memory_order_relaxed);
+    stats.files = stat_files_.load(memory_order_relaxed);
+    return stats;
+}
+
+//-----------------------------------------------------------------------------
+void PacketRecorder::writerLoop()
+{
+    while( running_ )
+    {
+        drain();
+        this_thread::sleep_for(chrono::milliseconds(WRITER_INTERVAL_MS));
+    }
+}
+
+//-----------------------------------------------------------------------------
+void PacketRecorder::drain()
+{
+    uint64_t tail = tail_.load(memory_order_relaxed);
+    const uint64_t head = head_.load(memory_order_acquire);
+    const int64_t now = monotonicNanoseconds();
+    const int64_t max_duration = int64_t(options_.max_file_duration_s)*1000000000;
+
+    // Consecutive records are collected into a single write, which is only interrupted
+    // at the end of the buffer and when starting a new file
+    size_t chunk_start = tail % buffer_size_;
+    size_t chunk_size = 0;
+    while( tail < head )
+    {
+        const size_t offset = tail % buffer_size_;
+        const size_t remaining = buffer_size_ - offset;
+        CaptureRecordHeader header;
+        if( remaining >= sizeof(header) )
+            memcpy(&header,&buffer_[offset],sizeof(header));
+        if( remaining < sizeof(header) || header.size == WRAP_MARKER )
+        {
+            writeFile(&buffer_[chunk_start],chunk_size);
+            tail += remaining;
+            chunk_start = 0;
+            chunk_size = 0;
+            continue;
+        }
+
+        const size_t record_size = sizeof(header) + header.size;
+        const bool size_exceeded = options_.max_file_size > 0 && file_size_ + chunk_size + record_size > options_.max_file_size;
+        const bool duration_exceeded = max_duration > 0 && now - file_open_time_ >= max_duration;
+        if( file_size_ + chunk_size > sizeof(CaptureFileHeader) && (size_exceeded || duration_exceeded) )
+        {
+            writeFile(&buffer_[chunk_start],chunk_size);
+            openFile();
+            chunk_start = offset;
+            chunk_size = 0;
+        }
+        chunk_size += record_size;
+        tail += record_size;
+        if( fd_ >= 0 )
+            stat_records_.fetch_add(1,memory_order_relaxed);
+        else
+            stat_dropped_.fetch_add(1,memory_order_relaxed);
+    }
+    writeFile(&buffer_[chunk_start],chunk_size);
+    tail_.store(tail,memory_order_release);
+}
+
+//-----------------------------------------------------------------------------
+void PacketRecorder::writeFile(const char *data, size_t size)
+{
+    if( fd_ < 0 )
+        return;
+    while( size > 0 )
+    {
+        const ssize_t written = write(fd_,data,size);
+        if( written < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+            cerr << "ERROR: Could not write capture file: " << strerror(errno) << endl;
+            close(fd_);
+            fd_ = -1;
+            return;
+        }
+        data += written;
+        size -= written;
+        file_size_ += written;
+        stat_bytes_.fetch_add(written,memory_order_relaxed);
+    }
+}
+
+//-----------------------------------------------------------------------------
+bool PacketRecorder::openFile()
+{
+    if( fd_ >= 0 )
+        close(fd_);
+
+    const bool rotate = ( options_.max_file_size > 0 || options_.max_file_duration_s > 0 );
+    const string file_name = rotate ? captureFileName(path_,file_index_) : path_;
+    file_index_++;
+    fd_ = open(file_name.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644);
+    file_size_ = 0;
+    file_open_time_ = monotonicNanoseconds();
+    if( fd_ < 0 )
+    {
+        cerr << "ERROR: Could not open capture file " << file_name << ": " << strerror(errno) << endl;
+        return false;
+    }
+    stat_files_.fetch_add(1,memory_order_relaxed);
+
+    CaptureFileHeader header;
+    header.magic = CAPTURE_FILE_MAGIC;
+    header.version = CAPTURE_FILE_VERSION;
+    header.header_size = sizeof(CaptureFileHeader);
+    writeFile((const char*) &header,sizeof(header));
+    return fd_ >= 0;
+}
+
+//-----------------------------------------------------------------------------
+string captureFileName(const string &path, uint64_t index)
+{
+    // Insert the index before the extension of the file name
+    const size_t slash = path.find_last_of('/');
+    size_t dot = path.find_last_of('.');
+    if( dot == string::npos || (slash != string::npos && dot < slash) )
+        dot = path.size();
+    char suffix[32];
+    snprintf(suffix,sizeof(suffix),"_%04llu",(unsigned long long) index);
+    return path.substr(0,dot) + suffix + path.substr(dot);
+}
+
+}
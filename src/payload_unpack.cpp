@@ -0,0 +1,298 @@
+#include <payload_unpack.h>
+#include <cstring>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PAYLOAD_UNPACK_X86
+#include <immintrin.h>
+#endif
+using namespace std;
+
+namespace pepperl_fuchs {
+
+//-----------------------------------------------------------------------------
+void unpackPayloadCScalar(const uint32_t *src, size_t count, uint32_t *distance, uint32_t *amplitude,
+                          uint64_t *valid_mask, size_t first_bit)
+{
+    uint64_t bits = 0;
+    size_t num_bits = 0;
+    for( size_t i=0; i<count; i++ )
+    {
+        const uint32_t word = src[i];
+        distance[i] = word & 0x000FFFFF;
+        amplitude[i] = word >> 20;
+        bits |= uint64_t(distance[i] != NO_ECHO_DISTANCE) << num_bits;
+        if( ++num_bits == 64 )
+        {
+            writeMaskBits(valid_mask,first_bit+i+1-64,bits,64);
+            bits = 0;
+            num_bits = 0;
+        }
+    }
+    writeMaskBits(valid_mask,first_bit+count-num_bits,bits,num_bits);
+}
+
+//-----------------------------------------------------------------------------
+void unpackPayloadAScalar(const uint32_t *src, size_t count, uint32_t *distance, uint64_t *valid_mask, size_t first_bit)
+{
+    uint64_t bits = 0;
+    size_t num_bits = 0;
+    for( size_t i=0; i<count; i++ )
+    {
+        const uint32_t word = src[i];
+        const bool echo = ( word != 0xFFFFFFFF );
+        distance[i] = echo ? word : NO_ECHO_DISTANCE;
+        bits |= uint64_t(echo) << num_bits;
+        if( ++num_bits == 64 )
+        {
+            writeMaskBits(valid_mask,first_bit+i+1-64,bits,64);
+            bits = 0;
+            num_bits = 0;
+        }
+    }
+    writeMaskBits(valid_mask,first_bit+count-num_bits,bits,num_bits);
+}
+
+//-----------------------------------------------------------------------------
+void unpackPayloadB(const char *src, size_t count, uint32_t *distance, uint32_t *amplitude,
+                    uint64_t *valid_mask, size_t first_bit)
+{
+    uint64_t bits = 0;
+    size_t num_bits = 0;
+    for( size_t i=0; i<count; i++ )
+    {
+        // Points are 6 bytes, so the words are unaligned
+        uint32_t word;
+        uint16_t amp;
+        memcpy(&word,src+6*i,sizeof(word));
+        memcpy(&amp,src+6*i+4,sizeof(amp));
+        const bool echo = ( word != 0xFFFFFFFF );
+        distance[i] = echo ? word : NO_ECHO_DISTANCE;
+        amplitude[i] = amp;
+        bits |= uint64_t(echo) << num_bits;
+        if( ++num_bits == 64 )
+        {
+            writeMaskBits(valid_mask,first_bit+i+1-64,bits,64);
+            bits = 0;
+            num_bits = 0;
+        }
+    }
+    writeMaskBits(valid_mask,first_bit+count-num_bits,bits,num_bits);
+}
+
+#ifdef PAYLOAD_UNPACK_X86
+//-----------------------------------------------------------------------------
+static void unpackPayloadASSE2(const uint32_t *src, size_t count, uint32_t *distance, uint64_t *valid_mask, size_t first_bit)
+{
+    const __m128i no_echo_in = _mm_set1_epi32(-1);
+    const __m128i no_echo_out = _mm_set1_epi32(NO_ECHO_DISTANCE);
+    uint64_t bits = 0;
+    size_t num_bits = 0;
+    size_t i = 0;
+    for( ; i+4<=count; i+=4 )
+    {
+        const __m128i words = _mm_loadu_si128((const __m128i*) (src+i));
+        const __m128i invalid_lanes = _mm_cmpeq_epi32(words,no_echo_in);
+
+        // Replace 0xFFFFFFFF by NO_ECHO_DISTANCE
+        _mm_storeu_si128((__m128i*) (distance+i),_mm_or_si128(_mm_andnot_si128(invalid_lanes,words),_mm_and_si128(invalid_lanes,no_echo_out)));
+
+        const int invalid = _mm_movemask_ps(_mm_castsi128_ps(invalid_lanes));
+        bits |= uint64_t(~invalid & 0xF) << num_bits;
+        num_bits += 4;
+        if( num_bits == 64 )
+        {
+            writeMaskBits(valid_mask,first_bit+i+4-64,bits,64);
+            bits = 0;
+            num_bits = 0;
+        }
+    }
+    writeMaskBits(valid_mask,first_bit+i-num_bits,bits,num_bits);
+    unpackPayloadAScalar(src+i,count-i,distance+i,valid_mask,first_bit+i);
+}
+
+//-----------------------------------------------------------------------------
+__attribute__((target("avx2")))
+static void unpackPayloadAAVX2(const uint32_t *src, size_t count, uint32_t *distance, uint64_t *valid_mask, size_t first_bit)
+{
+    const __m256i no_echo_in = _mm256_set1_epi32(-1);
+    const __m256i no_echo_out = _mm256_set1_epi32(NO_ECHO_DISTANCE);
+    uint64_t bits = 0;
+    size_t num_bits = 0;
+    size_t i = 0;
+    for( ; i+8<=count; i+=8 )
+    {
+        const __m256i words = _mm256_loadu_si256((const __m256i*) (src+i));
+        const __m256i invalid_lanes = _mm256_cmpeq_epi32(words,no_echo_in);
+
+        // Replace 0xFFFFFFFF by NO_ECHO_DISTANCE
+        _mm256_storeu_si256((__m256i*) (distance+i),_mm256_blendv_epi8(words,no_echo_out,invalid_lanes));
+
+        const int invalid = _mm256_movemask_ps(_mm256_castsi256_ps(invalid_lanes));
+        bits |= uint64_t(~invalid & 0xFF) << num_bits;
+        num_bits += 8;
+        if( num_bits == 64 )
+        {
+            writeMaskBits(valid_mask,first_bit+i+8-64,bits,64);
+            bits = 0;
+            num_bits = 0;
+        }
+    }
+    writeMaskBits(valid_mask,first_bit+i-num_bits,bits,num_bits);
+    unpackPayloadAScalar(src+i,count-i,distance+i,valid_mask,first_bit+i);
+}
+
+//-----------------------------------------------------------------------------
+static void unpackPayloadCSSE2(const uint32_t *src, size_t count, uint32_t *distance, uint32_t *amplitude,
+                               uint64_t *valid_mask, size_t first_bit)
+{
+    const __m128i distance_bits = _mm_set1_epi32(0x000FFFFF);
+    const __m128i no_echo = _mm_set1_epi32(NO_ECHO_DISTANCE);
+    uint64_t bits = 0;
+    size_t num_bits = 0;
+    size_t i = 0;
+    for( ; i+4<=count; i+=4 )
+    {
+        const __m128i words = _mm_loadu_si128((const __m128i*) (src+i));
+        const __m128i dist = _mm_and_si128(words,distance_bits);
+        _mm_storeu_si128((__m128i*) (distance+i),dist);
+        _mm_storeu_si128((__m128i*) (amplitude+i),_mm_srli_epi32(words,20));
+
+        // One bit per lane, set where distance equals the no echo marker
+        const int invalid = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(dist,no_echo)));
+        bits |= uint64_t(~invalid & 0xF) << num_bits;
+        num_bits += 4;
+        if( num_bits == 64 )
+        {
+            writeMaskBits(valid_mask,first_bit+i+4-64,bits,64);
+            bits = 0;
+            num_bits = 0;
+        }
+    }
+    writeMaskBits(valid_mask,first_bit+i-num_bits,bits,num_bits);
+    unpackPayloadCScalar(src+i,count-i,distance+i,amplitude+i,valid_mask,first_bit+i);
+}
+
+//-----------------------------------------------------------------------------
+__attribute__((target("avx2")))
+static void unpackPayloadCAVX2(const uint32_t *src, size_t count, uint32_t *distance, uint32_t *amplitude,
+                               uint64_t *valid_mask, size_t first_bit)
+{
+    const __m256i distance_bits = _mm256_set1_epi32(0x000FFFFF);
+    const __m256i no_echo = _mm256_set1_epi32(NO_ECHO_DISTANCE);
+    uint64_t bits = 0;
+    size_t num_bits = 0;
+    size_t i = 0;
+    for( ; i+8<=count; i+=8 )
+    {
+        const __m256i words = _mm256_loadu_si256((const __m256i*) (src+i));
+        const __m256i dist = _mm256_and_si256(words,distance_bits);
+        _mm256_storeu_si256((__m256i*) (distance+i),dist);
+        _mm256_storeu_si256((__m256i*) (amplitude+i),_mm256_srli_epi32(words,20));
+
+        // One bit per lane, set where distance equals the no echo marker
+        const int invalid = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(dist,no_echo)));
+        bits |= uint64_t(~invalid & 0xFF) << num_bits;
+        num_bits += 8;
+        if( num_bits == 64 )
+        {
+            writeMaskBits(valid_mask,first_bit+i+8-64,bits,64);
+            bits = 0;
+            num_bits = 0;
+        }
+    }
+    writeMaskBits(valid_mask,first_bit+i-num_bits,bits,num_bits);
+    unpackPayloadCScalar(src+i,count-i,distance+i,amplitude+i,valid_mask,first_bit+i);
+}
+#endif
+
+//-----------------------------------------------------------------------------
+bool isUnpackKernelSupported(UnpackKernel kernel)
+{
+#ifdef PAYLOAD_UNPACK_X86
+    __builtin_cpu_init();
+    if( kernel == UNPACK_KERNEL_AVX2 )
+        return __builtin_cpu_supports("avx2");
+    if( kernel == UNPACK_KERNEL_SSE2 )
+        return __builtin_cpu_supports("sse2");
+#endif
+    return kernel == UNPACK_KERNEL_SCALAR;
+}
+
+//-----------------------------------------------------------------------------
+typedef void (*UnpackPayloadFunction)(const uint32_t*, size_t, uint32_t*, uint32_t*, uint64_t*, size_t);
+
+//-----------------------------------------------------------------------------
+static UnpackPayloadFunction unpackPayloadCFunction(UnpackKernel kernel)
+{
+#ifdef PAYLOAD_UNPACK_X86
+    if( kernel == UNPACK_KERNEL_AVX2 )
+        return &unpackPayloadCAVX2;
+    if( kernel == UNPACK_KERNEL_SSE2 )
+        return &unpackPayloadCSSE2;
+#endif
+    return &unpackPayloadCScalar;
+}
+
+//-----------------------------------------------------------------------------
+static UnpackPayloadFunction selectUnpackPayloadC()
+{
+    if( isUnpackKernelSupported(UNPACK_KERNEL_AVX2) )
+        return unpackPayloadCFunction(UNPACK_KERNEL_AVX2);
+    if( isUnpackKernelSupported(UNPACK_KERNEL_SSE2) )
+        return unpackPayloadCFunction(UNPACK_KERNEL_SSE2);
+    return &unpackPayloadCScalar;
+}
+
+//-----------------------------------------------------------------------------
+typedef void (*UnpackPayloadAFunction)(const uint32_t*, size_t, uint32_t*, uint64_t*, size_t);
+
+//-----------------------------------------------------------------------------
+static UnpackPayloadAFunction unpackPayloadAFunction(UnpackKernel kernel)
+{
+#ifdef PAYLOAD_UNPACK_X86
+    if( kernel == UNPACK_KERNEL_AVX2 )
+        return &unpackPayloadAAVX2;
+    if( kernel == UNPACK_KERNEL_SSE2 )
+        return &unpackPayloadASSE2;
+#endif
+    return &unpackPayloadAScalar;
+}
+
+//-----------------------------------------------------------------------------
+static UnpackPayloadAFunction selectUnpackPayloadA()
+{
+    if( isUnpackKernelSupported(UNPACK_KERNEL_AVX2) )
+        return unpackPayloadAFunction(UNPACK_KERNEL_AVX2);
+    if( isUnpackKernelSupported(UNPACK_KERNEL_SSE2) )
+        return unpackPayloadAFunction(UNPACK_KERNEL_SSE2);
+    return &unpackPayloadAScalar;
+}
+
+//-----------------------------------------------------------------------------
+void unpackPayloadA(const uint32_t *src, size_t count, uint32_t *distance, uint64_t *valid_mask, size_t first_bit)
+{
+    static const UnpackPayloadAFunction unpack = selectUnpackPayloadA();
+    unpack(src,count,distance,valid_mask,first_bit);
+}
+
+//-----------------------------------------------------------------------------
+void unpackPayloadA(UnpackKernel kernel, const uint32_t *src, size_t count, uint32_t *distance, uint64_t *valid_mask, size_t first_bit)
+{
+    unpackPayloadAFunction(kernel)(src,count,distance,valid_mask,first_bit);
+}
+
+//-----------------------------------------------------------------------------
+void unpackPayloadC(const uint32_t *src, size_t count, uint32_t *distance, uint32_t *amplitude,
+                    uint64_t *valid_mask, size_t first_bit)
+{
+    static const UnpackPayloadFunction unpack = selectUnpackPayloadC();
+    unpack(src,count,distance,amplitude,valid_mask,first_bit);
+}
+
+//-----------------------------------------------------------------------------
+void unpackPayloadC(UnpackKernel kernel, const uint32_t *src, size_t count, uint32_t *distance, uint32_t *amplitude,
+                    uint64_t *valid_mask, size_t first_bit)
+{
+    unpackPayloadCFunction(kernel)(src,count,distance,amplitude,valid_mask,first_bit);
+}
+
+}
@@ -1,43 +1,115 @@
 
-#include <ctime>
+#include <chrono>
+#include <memory>
 #include <r2000_driver.h>
 #include <packet_structure.h>
 #include <command_interface.h>
 #include <data_receiver.h>
+#include <capture_replay.h>
+#include <scanner_clock.h>
 using namespace std;
 
 namespace pepperl_fuchs {
 
 R2000Driver::R2000Driver()
 {
-    command_interface_ = 0;
+    initialize(0);
+}
+
+//-----------------------------------------------------------------------------
+R2000Driver::R2000Driver(boost::asio::io_service &io_service)
+{
+    initialize(&io_service);
+}
+
+//-----------------------------------------------------------------------------
+void R2000Driver::initialize(boost::asio::io_service *io_service)
+{
     data_receiver_ = 0;
+    capture_replay_ = 0;
+    io_service_ = io_service;
+    receiver_options_ = ReceiverOptions();
+    packet_type_ = 'C';
     is_connected_ = false;
     is_capturing_ = false;
     watchdog_feed_time_ = 0;
+    food_timeout_ = 1.0;
+    watchdog_running_ = false;
+    watchdog_handlers_ = 0;
+    watchdog_stats_ = WatchdogStats();
+    feed_pending_ = false;
+    link_command_pending_ = false;
+    next_feed_time_ = 0;
+    monitor_link_ = false;
+    capture_start_time_ = 0;
+    link_lost_time_ = 0;
+    link_recovery_time_ = 0;
+    link_stats_ = LinkStats();
+    next_subscription_id_ = 1;
 }
 
 //-----------------------------------------------------------------------------
 bool R2000Driver::connect(const string hostname, int port)
 {
-    command_interface_ = new CommandInterface(hostname,port);
-    auto opi = command_interface_->getProtocolInfo();
-    if( !opi || (*opi).version_major != 1 )
-    {
-        cerr << "ERROR: Could not connect to laser range finder!" << endl;
-        return false;
-    }
+    return connectAsync(hostname,port).get();
+}
 
-    if( (*opi).version_major != 1 )
+//-----------------------------------------------------------------------------
+future<bool> R2000Driver::connectAsync(const string &hostname, int port)
+{
+    // Results of the requests running concurrently
+    struct ConnectState
     {
-        cerr << "ERROR: Wrong protocol version (version_major=" << (*opi).version_major << ", version_minor=" << (*opi).version_minor << ")" << endl;
-        return false;
+        ConnectState() : remaining(2) {}
+        boost::optional<ProtocolInfo> protocol_info;
+        vector<string> parameter_list;
+        atomic<int> remaining;
+        promise<bool> result;
+    };
+    shared_ptr<ConnectState> state = make_shared<ConnectState>();
+
+    lock_guard<recursive_mutex> lock(state_mutex_);
+    shared_ptr<CommandInterface> command_interface = make_shared<CommandInterface>(hostname,port,io_service_);
+    {
+        lock_guard<mutex> handle_lock(handle_mutex_);
+        command_interface_ = command_interface;
     }
 
-    protocol_info_ = *opi;
-    parameters_ = command_interface_->getParameters(command_interface_->getParameterList());
-    is_connected_ = true;
-    return true;
+    // Protocol info and parameter list are requested at once, the parameter values once both arrived.
+    // The handlers run on the IO thread of the interface, so they must not own it.
+    CommandInterface* ci = command_interface.get();
+    auto proceed = [this,ci,state]()
+    {
+        if( --state->remaining > 0 )
+            return;
+
+        const boost::optional<ProtocolInfo>& opi = state->protocol_info;
+        if( !opi )
+        {
+            cerr << "ERROR: Could not connect to laser range finder!" << endl;
+            state->result.set_value(false);
+            return;
+        }
+
+        if( (*opi).version_major != 1 )
+        {
+            cerr << "ERROR: Wrong protocol version (version_major=" << (*opi).version_major << ", version_minor=" << (*opi).version_minor << ")" << endl;
+            state->result.set_value(false);
+            return;
+        }
+
+        ci->getParametersAsync(state->parameter_list,[this,state](map< string, string > parameters)
+        {
+            lock_guard<recursive_mutex> state_lock(state_mutex_);
+            protocol_info_ = *state->protocol_info;
+            parameters_ = parameters;
+            is_connected_ = true;
+            state->result.set_value(true);
+        });
+    };
+    ci->getProtocolInfoAsync([state,proceed](boost::optional<ProtocolInfo> pi) { state->protocol_info = pi; proceed(); });
+    ci->getParameterListAsync([state,proceed](vector<string> parameter_list) { state->parameter_list = parameter_list; proceed(); });
+    return state->result.get_future();
 }
 
 //-----------------------------------------------------------------------------
@@ -49,26 +121,138 @@ R2000Driver::~R2000Driver()
 //-----------------------------------------------------------------------------
 bool R2000Driver::startCapturingUDP()
 {
+    lock_guard<recursive_mutex> lock(state_mutex_);
     if( !checkConnection() )
         return false;
 
-    data_receiver_ = new DataReceiver();
+    data_receiver_ = new DataReceiver(receiver_options_,io_service_);
     if( !data_receiver_->isConnected() )
+    {
+        abortCapture();
         return false;
+    }
+    data_receiver_->setScanSubscriptions(scan_subscriptions_);
+    data_receiver_->setSectorSubscriptions(sector_subscriptions_);
+    data_receiver_->setRecorder(recorder_);
     int udp_port = data_receiver_->getUDPPort();
 
-    handle_info_ = command_interface_->requestHandleUDP(udp_port);
+    boost::optional<HandleInfo> handle_info = command_interface_->requestHandleUDP(udp_port,receiver_options_.bind_address,-1800000,packet_type_);
+    {
+        lock_guard<mutex> handle_lock(handle_mutex_);
+        handle_info_ = handle_info;
+    }
     if( !handle_info_ || !command_interface_->startScanOutput((*handle_info_).handle) )
+    {
+        abortCapture();
         return false;
+    }
+
+    // The link monitor restarts the handle after an interruption, the receiver must keep its socket
+    data_receiver_->setDataTimeout(0);
+    monitor_link_ = true;
 
     food_timeout_ = floor(max((handle_info_->watchdog_timeout/1000.0/3.0),1.0));
     is_capturing_ = true;
+    startWatchdog();
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool R2000Driver::startCapturingTCP()
+{
+    lock_guard<recursive_mutex> lock(state_mutex_);
+    if( !checkConnection() )
+        return false;
+
+    boost::optional<HandleInfo> handle_info = command_interface_->requestHandleTCP(-1800000,packet_type_);
+    {
+        lock_guard<mutex> handle_lock(handle_mutex_);
+        handle_info_ = handle_info;
+    }
+    if( !handle_info_ )
+        return false;
+
+    data_receiver_ = new DataReceiver(handle_info_->hostname,handle_info_->port,io_service_,receiver_options_);
+    if( !data_receiver_->isConnected() )
+    {
+        abortCapture();
+        return false;
+    }
+    data_receiver_->setScanSubscriptions(scan_subscriptions_);
+    data_receiver_->setSectorSubscriptions(sector_subscriptions_);
+    data_receiver_->setRecorder(recorder_);
+
+    if( !command_interface_->startScanOutput((*handle_info_).handle) )
+    {
+        abortCapture();
+        return false;
+    }
+    monitor_link_ = false;
+
+    food_timeout_ = floor(max((handle_info_->watchdog_timeout/1000.0/3.0),1.0));
+    is_capturing_ = true;
+    startWatchdog();
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+void R2000Driver::abortCapture()
+{
+    // Release the handle first, so the scanner stops sending before the receiver goes away
+    boost::optional<HandleInfo> handle_info;
+    {
+        lock_guard<mutex> handle_lock(handle_mutex_);
+        handle_info.swap(handle_info_);
+    }
+    if( handle_info && command_interface_ )
+        command_interface_->releaseHandle(handle_info->handle);
+
+    delete data_receiver_;
+    data_receiver_ = 0;
+}
+
+//-----------------------------------------------------------------------------
+bool R2000Driver::startReplay(const string &path, double speed)
+{
+    lock_guard<recursive_mutex> lock(state_mutex_);
+    if( is_capturing_ )
+        return false;
+
+    ReceiverOptions options = receiver_options_;
+    options.receive_mode = RECEIVE_MODE_INJECT;
+    data_receiver_ = new DataReceiver(options,io_service_);
+    data_receiver_->setScanSubscriptions(scan_subscriptions_);
+    data_receiver_->setSectorSubscriptions(sector_subscriptions_);
+
+    capture_replay_ = new CaptureReplay(path,*data_receiver_,speed);
+    if( !capture_replay_->isOpen() )
+    {
+        delete capture_replay_;
+        delete data_receiver_;
+        capture_replay_ = 0;
+        data_receiver_ = 0;
+        return false;
+    }
+    is_capturing_ = true;
     return true;
 }
 
 //-----------------------------------------------------------------------------
 bool R2000Driver::stopCapturing()
 {
+    stopWatchdog();
+    lock_guard<recursive_mutex> lock(state_mutex_);
+    if( capture_replay_ )
+    {
+        // Disconnect first, the replay thread may wait for room in the scan queue
+        data_receiver_->disconnect();
+        delete capture_replay_;
+        delete data_receiver_;
+        capture_replay_ = 0;
+        data_receiver_ = 0;
+        is_capturing_ = false;
+        return true;
+    }
     if( !is_capturing_ || !command_interface_ )
         return false;
 
@@ -80,7 +264,10 @@ bool R2000Driver::stopCapturing()
     data_receiver_ = 0;
 
     is_capturing_ = false;
-    return_val = return_val && command_interface_->releaseHandle(handle_info_->handle);
+
+    // Release even if the output could not be stopped, otherwise the handle lives until the scanner's watchdog expires
+    return_val = command_interface_->releaseHandle(handle_info_->handle) && return_val;
+    lock_guard<mutex> handle_lock(handle_mutex_);
     handle_info_ = boost::optional<HandleInfo>();
     return return_val;
 }
@@ -88,6 +275,7 @@ bool R2000Driver::stopCapturing()
 //-----------------------------------------------------------------------------
 bool R2000Driver::checkConnection()
 {
+    lock_guard<recursive_mutex> lock(state_mutex_);
     if( !command_interface_ || !isConnected() || !command_interface_->getProtocolInfo() )
     {
         cerr << "ERROR: No connection to laser range finder or connection lost!" << endl;
@@ -99,7 +287,6 @@ bool R2000Driver::checkConnection()
 //-----------------------------------------------------------------------------
 ScanData R2000Driver::getFullScan()
 {
-    feedWatchdog();
     if( data_receiver_ )
         return data_receiver_->getFullScan();
     else
@@ -109,21 +296,192 @@ ScanData R2000Driver::getFullScan()
     }
 }
 
+//-----------------------------------------------------------------------------
+ReceiverStats R2000Driver::getReceiverStats() const
+{
+    if( data_receiver_ )
+        return data_receiver_->getStats();
+    ReceiverStats stats = ReceiverStats();
+    stats.receive_mode = receiver_options_.receive_mode;
+    return stats;
+}
+
+//-----------------------------------------------------------------------------
+bool R2000Driver::startRecording(const string &path, const RecorderOptions &options)
+{
+    shared_ptr<PacketRecorder> recorder = make_shared<PacketRecorder>(path,options);
+    if( !recorder->isOpen() )
+        return false;
+
+    lock_guard<recursive_mutex> lock(state_mutex_);
+    recorder_ = recorder;
+    if( data_receiver_ )
+        data_receiver_->setRecorder(recorder_);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+void R2000Driver::stopRecording()
+{
+    // The receiver does not feed the recorder anymore once setRecorder() returned,
+    // so the remaining data is written by the destructor below
+    shared_ptr<PacketRecorder> recorder;
+    {
+        lock_guard<recursive_mutex> lock(state_mutex_);
+        if( data_receiver_ )
+            data_receiver_->setRecorder(shared_ptr<PacketRecorder>());
+        recorder.swap(recorder_);
+    }
+}
+
+//-----------------------------------------------------------------------------
+RecorderStats R2000Driver::getRecorderStats() const
+{
+    lock_guard<recursive_mutex> lock(state_mutex_);
+    if( recorder_ )
+        return recorder_->getStats();
+    return RecorderStats();
+}
+
+//-----------------------------------------------------------------------------
+bool R2000Driver::setPacketType(char packet_type)
+{
+    if( packet_type != 'A' && packet_type != 'B' && packet_type != 'C' )
+        return false;
+    packet_type_ = packet_type;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+ReceiverOptions R2000Driver::getEffectiveReceiverOptions() const
+{
+    if( data_receiver_ )
+        return data_receiver_->getEffectiveOptions();
+    return receiver_options_;
+}
+
+//-----------------------------------------------------------------------------
+void R2000Driver::releaseScan(ScanData&& scan)
+{
+    if( data_receiver_ )
+        data_receiver_->releaseScan(move(scan));
+}
+
+//-----------------------------------------------------------------------------
+unsigned int R2000Driver::subscribeScans(const ScanCallback &callback)
+{
+    return addScanSubscription(callback,0);
+}
+
+//-----------------------------------------------------------------------------
+unsigned int R2000Driver::subscribeScans(const ScanCallback &callback, boost::asio::io_service &executor)
+{
+    return addScanSubscription(callback,&executor);
+}
+
+//-----------------------------------------------------------------------------
+unsigned int R2000Driver::addScanSubscription(const ScanCallback &callback, boost::asio::io_service *executor)
+{
+    lock_guard<recursive_mutex> lock(state_mutex_);
+    ScanSubscription subscription;
+    subscription.id = next_subscription_id_++;
+    subscription.callback = callback;
+    subscription.executor = executor;
+    scan_subscriptions_.push_back(subscription);
+    if( data_receiver_ )
+        data_receiver_->setScanSubscriptions(scan_subscriptions_);
+    return subscription.id;
+}
+
+//-----------------------------------------------------------------------------
+void R2000Driver::unsubscribeScans(unsigned int id)
+{
+    lock_guard<recursive_mutex> lock(state_mutex_);
+    for( auto it=scan_subscriptions_.begin(); it!=scan_subscriptions_.end(); it++ )
+    {
+        if( it->id == id )
+        {
+            scan_subscriptions_.erase(it);
+            break;
+        }
+    }
+    if( data_receiver_ )
+        data_receiver_->setScanSubscriptions(scan_subscriptions_);
+}
+
+//-----------------------------------------------------------------------------
+unsigned int R2000Driver::subscribeSectorsByPackets(const SectorCallback &callback, unsigned int packets_per_sector)
+{
+    return addSectorSubscription(callback,max(packets_per_sector,1u),0.0);
+}
+
+//-----------------------------------------------------------------------------
+unsigned int R2000Driver::subscribeSectorsByAngle(const SectorCallback &callback, double degrees_per_sector)
+{
+    return addSectorSubscription(callback,0,degrees_per_sector);
+}
+
+//-----------------------------------------------------------------------------
+unsigned int R2000Driver::addSectorSubscription(const SectorCallback &callback, unsigned int packets_per_sector, double degrees_per_sector)
+{
+    lock_guard<recursive_mutex> lock(state_mutex_);
+    SectorSubscription subscription;
+    subscription.id = next_subscription_id_++;
+    subscription.callback = callback;
+    subscription.packets_per_sector = packets_per_sector;
+    subscription.degrees_per_sector = degrees_per_sector;
+    sector_subscriptions_.push_back(subscription);
+    if( data_receiver_ )
+        data_receiver_->setSectorSubscriptions(sector_subscriptions_);
+    return subscription.id;
+}
+
+//-----------------------------------------------------------------------------
+void R2000Driver::unsubscribeSectors(unsigned int id)
+{
+    lock_guard<recursive_mutex> lock(state_mutex_);
+    for( auto it=sector_subscriptions_.begin(); it!=sector_subscriptions_.end(); it++ )
+    {
+        if( it->id == id )
+        {
+            sector_subscriptions_.erase(it);
+            break;
+        }
+    }
+    if( data_receiver_ )
+        data_receiver_->setSectorSubscriptions(sector_subscriptions_);
+}
+
 //-----------------------------------------------------------------------------
 void R2000Driver::disconnect()
 {
-    if( isCapturing() )
+    stopWatchdog();
+    lock_guard<recursive_mutex> lock(state_mutex_);
+
+    // Also after the link monitor gave up and disconnected the receiver, the handle is still held
+    if( is_capturing_ )
         stopCapturing();
 
+    // A finished replay is no capture anymore, its thread must be gone before the receiver
+    if( data_receiver_ )
+        data_receiver_->disconnect();
+    delete capture_replay_;
     delete data_receiver_;
-    delete command_interface_;
+    capture_replay_ = 0;
     data_receiver_ = 0;
-    command_interface_ = 0;
+
+    // Commands still running on other threads keep the interface alive until they return
+    shared_ptr<CommandInterface> command_interface;
+    {
+        lock_guard<mutex> handle_lock(handle_mutex_);
+        command_interface.swap(command_interface_);
+        handle_info_ = boost::optional<HandleInfo>();
+    }
+    command_interface.reset();
 
     is_capturing_ = false;
     is_connected_ = false;
 
-    handle_info_ = boost::optional<HandleInfo>();
     protocol_info_ = ProtocolInfo();
     parameters_ = map< string, string >();
 }
@@ -137,62 +495,429 @@ bool R2000Driver::isCapturing()
 //-----------------------------------------------------------------------------
 const map< string, string >& R2000Driver::getParameters()
 {
-    if( command_interface_ )
-        parameters_ = command_interface_->getParameters(command_interface_->getParameterList());
+    shared_ptr<CommandInterface> command_interface = getCommandInterface();
+    if( command_interface )
+    {
+        map< string, string > parameters = command_interface->getParameters(command_interface->getParameterList());
+        lock_guard<recursive_mutex> lock(state_mutex_);
+        parameters_ = parameters;
+    }
     return parameters_;
 }
 
 //-----------------------------------------------------------------------------
 bool R2000Driver::setScanFrequency(unsigned int frequency)
 {
-    if( !command_interface_ )
+    shared_ptr<CommandInterface> command_interface = getCommandInterface();
+    if( !command_interface )
         return false;
-    return command_interface_->setParameter("scan_frequency",to_string(frequency));
+    return command_interface->setParameter("scan_frequency",to_string(frequency));
 }
 
 //-----------------------------------------------------------------------------
 bool R2000Driver::setSamplesPerScan(unsigned int samples)
 {
-    if( !command_interface_ )
+    shared_ptr<CommandInterface> command_interface = getCommandInterface();
+    if( !command_interface )
         return false;
-    return command_interface_->setParameter("samples_per_scan",to_string(samples));
+    return command_interface->setParameter("samples_per_scan",to_string(samples));
 }
 
 //-----------------------------------------------------------------------------
 bool R2000Driver::rebootDevice()
 {
-    if( !command_interface_ )
+    shared_ptr<CommandInterface> command_interface = getCommandInterface();
+    if( !command_interface )
         return false;
-    return command_interface_->rebootDevice();
+    return command_interface->rebootDevice();
 }
 
 //-----------------------------------------------------------------------------
 bool R2000Driver::resetParameters(const vector<string> &names)
 {
-    if( !command_interface_ )
+    shared_ptr<CommandInterface> command_interface = getCommandInterface();
+    if( !command_interface )
         return false;
-    return command_interface_->resetParameters(names);
+    return command_interface->resetParameters(names);
 }
 
 //-----------------------------------------------------------------------------
 bool R2000Driver::setParameter(const string &name, const string &value)
 {
-    if( !command_interface_ )
+    shared_ptr<CommandInterface> command_interface = getCommandInterface();
+    if( !command_interface )
         return false;
-    return command_interface_->setParameter(name,value);
+    return command_interface->setParameter(name,value);
 }
 
 //-----------------------------------------------------------------------------
-void R2000Driver::feedWatchdog(bool feed_always)
+bool R2000Driver::feedWatchdog(bool feed_always)
 {
-    const double current_time = time(0);
+    const double current_time = chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+    shared_ptr<CommandInterface> command_interface;
+    boost::optional<HandleInfo> handle_info;
+    {
+        lock_guard<mutex> handle_lock(handle_mutex_);
+        if( !feed_always && watchdog_feed_time_>=(current_time-food_timeout_) )
+            return true;
+        command_interface = command_interface_;
+        handle_info = handle_info_;
+    }
 
-    if( (feed_always || watchdog_feed_time_<(current_time-food_timeout_)) && handle_info_ && command_interface_  )
+    if( handle_info && command_interface )
     {
-        if( !command_interface_->feedWatchdog(handle_info_->handle) )
+        if( !command_interface->feedWatchdog(handle_info->handle) )
+        {
             cerr << "ERROR: Feeding watchdog failed!" << endl;
+            return false;
+        }
+        lock_guard<mutex> handle_lock(handle_mutex_);
         watchdog_feed_time_ = current_time;
     }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+WatchdogStats R2000Driver::getWatchdogStats() const
+{
+    lock_guard<mutex> lock(watchdog_mutex_);
+    return watchdog_stats_;
+}
+
+//-----------------------------------------------------------------------------
+LinkStats R2000Driver::getLinkStats() const
+{
+    lock_guard<mutex> lock(watchdog_mutex_);
+    return link_stats_;
+}
+
+//-----------------------------------------------------------------------------
+void R2000Driver::startWatchdog()
+{
+    boost::asio::io_service* io_service;
+    {
+        lock_guard<mutex> handle_lock(handle_mutex_);
+        io_service = &command_interface_->getIoService();
+    }
+    watchdog_timer_.reset(new boost::asio::steady_timer(*io_service));
+    watchdog_strand_.reset(new boost::asio::io_service::strand(*io_service));
+    capture_start_time_ = monotonicNanoseconds();
+
+    lock_guard<mutex> lock(watchdog_mutex_);
+    watchdog_running_ = true;
+    watchdog_stats_ = WatchdogStats();
+    link_stats_ = LinkStats();
+    next_feed_time_ = capture_start_time_ + int64_t(food_timeout_*1e9);
+    scheduleWatchdog(capture_start_time_);
+}
+
+//-----------------------------------------------------------------------------
+void R2000Driver::stopWatchdog()
+{
+    unique_lock<mutex> lock(watchdog_mutex_);
+    watchdog_running_ = false;
+    if( !watchdog_timer_ )
+        return;
+
+    // Handlers and commands of the watchdog run on the IO thread and refer to the driver,
+    // after the io_service has been stopped they never run and nothing can be waited for
+    if( !watchdog_strand_->context().stopped() )
+    {
+        watchdog_handlers_++;
+        watchdog_strand_->post([this]()
+        {
+            watchdog_timer_->cancel();
+            lock_guard<mutex> lock(watchdog_mutex_);
+            watchdog_handlers_--;
+            watchdog_condition_.notify_all();
+        });
+        watchdog_condition_.wait(lock,[this]() { return watchdog_handlers_ == 0 && !feed_pending_ && !link_command_pending_; });
+    }
+    lock.unlock();
+    watchdog_timer_.reset();
+    watchdog_strand_.reset();
+}
+
+//-----------------------------------------------------------------------------
+void R2000Driver::scheduleWatchdog(int64_t now)
+{
+    // Without link monitoring the timer only wakes up to feed, a pending feed is looked at again after the retry interval
+    int64_t wakeup_time = feed_pending_ ? now + int64_t(WATCHDOG_RETRY_INTERVAL_MS)*1000000 : next_feed_time_;
+    if( monitor_link_ )
+        wakeup_time = min(wakeup_time,now + int64_t(LINK_CHECK_INTERVAL_MS)*1000000);
+    watchdog_timer_->expires_from_now(chrono::nanoseconds(max(wakeup_time-now,int64_t(0))));
+    watchdog_timer_->async_wait(watchdog_strand_->wrap(boost::bind(&R2000Driver::watchdogTick, this, boost::asio::placeholders::error)));
+    watchdog_handlers_++;
+}
+
+//-----------------------------------------------------------------------------
+void R2000Driver::watchdogTick(const boost::system::error_code& error)
+{
+    unique_lock<mutex> lock(watchdog_mutex_);
+    if( !error && watchdog_running_ )
+    {
+        // Commands are only issued here and complete on the IO thread, so neither the link check
+        // nor stopWatchdog() wait for a scanner which does not answer
+        lock.unlock();
+        checkLink();
+        lock.lock();
+    }
+    // After the link monitor gave up the receiver is disconnected, the handle is not fed anymore
+    if( error || !watchdog_running_ || link_stats_.state == LINK_FAILED )
+    {
+        // Notify with the lock held, stopWatchdog() may destroy the driver as soon as it is released
+        watchdog_handlers_--;
+        watchdog_condition_.notify_all();
+        return;
+    }
+
+    const int64_t now = monotonicNanoseconds();
+    const bool feed = !feed_pending_ && now >= next_feed_time_;
+    feed_pending_ = feed_pending_ || feed;
+    scheduleWatchdog(now);
+    watchdog_handlers_--;
+    lock.unlock();
+    if( feed )
+        feedWatchdogAsync();
+}
+
+//-----------------------------------------------------------------------------
+void R2000Driver::feedWatchdogAsync()
+{
+    CommandInterface* command_interface;
+    boost::optional<HandleInfo> handle_info;
+    {
+        lock_guard<mutex> handle_lock(handle_mutex_);
+        command_interface = command_interface_.get();
+        handle_info = handle_info_;
+    }
+    if( !handle_info || !command_interface )
+    {
+        finishFeed(true);
+        return;
+    }
+    command_interface->feedWatchdogAsync(handle_info->handle,[this](bool fed) { finishFeed(fed); });
+}
+
+//-----------------------------------------------------------------------------
+void R2000Driver::finishFeed(bool fed)
+{
+    const int64_t now = monotonicNanoseconds();
+    if( fed )
+    {
+        lock_guard<mutex> handle_lock(handle_mutex_);
+        watchdog_feed_time_ = chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    else
+        cerr << "ERROR: Feeding watchdog failed!" << endl;
+
+    bool recover = false;
+    {
+        lock_guard<mutex> lock(watchdog_mutex_);
+        feed_pending_ = false;
+        if( fed )
+        {
+            watchdog_stats_.feeds++;
+            watchdog_stats_.consecutive_failures = 0;
+            next_feed_time_ = now + int64_t(food_timeout_*1e9);
+        }
+        else
+        {
+            watchdog_stats_.failures++;
+            watchdog_stats_.consecutive_failures++;
+            next_feed_time_ = now + int64_t(WATCHDOG_RETRY_INTERVAL_MS)*1000000;
+
+            // Escalate: the scanner may have dropped the handle already, e.g. after a restart
+            recover = watchdog_stats_.consecutive_failures >= WATCHDOG_MAX_FAILURES && watchdog_running_ && !link_command_pending_;
+            link_command_pending_ = link_command_pending_ || recover;
+        }
+
+        // Notify with the lock held, stopWatchdog() may destroy the driver as soon as it is released
+        watchdog_condition_.notify_all();
+    }
+    if( !recover )
+        return;
+
+    cerr << "ERROR: Watchdog could not be fed repeatedly, requesting a new handle" << endl;
+    recoverHandleAsync([this](bool recovered)
+    {
+        {
+            lock_guard<mutex> lock(watchdog_mutex_);
+            link_command_pending_ = false;
+            if( recovered )
+            {
+                watchdog_stats_.recoveries++;
+                watchdog_stats_.consecutive_failures = 0;
+            }
+            watchdog_condition_.notify_all();
+        }
+    });
+}
+
+//-----------------------------------------------------------------------------
+void R2000Driver::checkLink()
+{
+    if( !monitor_link_ )
+        return;
+
+    // Lost if no packet arrived for several packet intervals, a scan at 50 Hz with 3600 points
+    // is sent in 43 packets, so an interruption is noticed within a few tens of milliseconds
+    const int64_t now = monotonicNanoseconds();
+    const int64_t last_packet_time = max(data_receiver_->getLastPacketTime(),capture_start_time_);
+    int64_t timeout = int64_t(LINK_STARTUP_TIMEOUT_MS)*1000000;
+    if( data_receiver_->getLastPacketTime() > 0 )
+        timeout = max(int64_t(LINK_LOSS_MIN_TIMEOUT_MS)*1000000,LINK_LOSS_PACKET_INTERVALS*data_receiver_->getPacketInterval());
+
+    unique_lock<mutex> lock(watchdog_mutex_);
+    switch( link_stats_.state )
+    {
+    case LINK_UP:
+        if( now - last_packet_time <= timeout )
+            return;
+        link_stats_.state = LINK_LOST;
+        link_stats_.losses++;
+        link_lost_time_ = last_packet_time;
+        link_recovery_time_ = 0;
+        data_receiver_->markGap();
+        cerr << "ERROR: No data received for " << (now-last_packet_time)/1000000 << " ms, restarting scan output" << endl;
+        break;
+
+    case LINK_LOST:
+        if( last_packet_time > link_lost_time_ )
+        {
+            link_stats_.state = LINK_UP;
+            link_stats_.recoveries++;
+            link_stats_.last_downtime_ns = last_packet_time - link_lost_time_;
+            return;
+        }
+        if( now - link_lost_time_ > int64_t(LINK_GIVE_UP_MS)*1000000 )
+        {
+            link_stats_.state = LINK_FAILED;
+            lock.unlock();
+            cerr << "ERROR: Data stream could not be restored, disconnecting data receiver" << endl;
+            data_receiver_->disconnect();
+            return;
+        }
+        if( link_recovery_time_ > 0 && now - link_recovery_time_ < int64_t(LINK_RETRY_INTERVAL_MS)*1000000 )
+            return;
+        break;
+
+    case LINK_FAILED:
+        return;
+    }
+
+    // The previous attempt may still wait for the scanner, the loss is detected regardless
+    if( link_command_pending_ )
+        return;
+    link_command_pending_ = true;
+    link_recovery_time_ = now;
+    link_stats_.recovery_attempts++;
+    lock.unlock();
+    restartScanOutputAsync();
+}
+
+//-----------------------------------------------------------------------------
+void R2000Driver::finishLinkCommand()
+{
+    lock_guard<mutex> lock(watchdog_mutex_);
+    link_command_pending_ = false;
+    watchdog_condition_.notify_all();
+}
+
+//-----------------------------------------------------------------------------
+void R2000Driver::restartScanOutputAsync()
+{
+    // The interface outlives the commands, stopWatchdog() waits for them before the driver lets go of it
+    CommandInterface* command_interface;
+    boost::optional<HandleInfo> handle_info;
+    {
+        lock_guard<mutex> handle_lock(handle_mutex_);
+        command_interface = command_interface_.get();
+        handle_info = handle_info_;
+    }
+    if( !handle_info || !command_interface )
+    {
+        finishLinkCommand();
+        return;
+    }
+
+    // A handle which survived the interruption only needs its output restarted
+    const string handle = handle_info->handle;
+    command_interface->feedWatchdogAsync(handle,[this,command_interface,handle](bool fed)
+    {
+        if( !fed )
+        {
+            recoverHandleAsync([this](bool) { finishLinkCommand(); });
+            return;
+        }
+        command_interface->startScanOutputAsync(handle,[this](bool started)
+        {
+            if( !started )
+            {
+                recoverHandleAsync([this](bool) { finishLinkCommand(); });
+                return;
+            }
+            {
+                lock_guard<mutex> handle_lock(handle_mutex_);
+                watchdog_feed_time_ = chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+            }
+            finishLinkCommand();
+        });
+    });
+}
+
+//-----------------------------------------------------------------------------
+void R2000Driver::recoverHandleAsync(const function<void(bool)> &handler)
+{
+    // Issued by the watchdog keeper, which is stopped before the receiver or the handle are replaced
+    CommandInterface* command_interface;
+    boost::optional<HandleInfo> old_handle_info;
+    {
+        lock_guard<mutex> handle_lock(handle_mutex_);
+        command_interface = command_interface_.get();
+        old_handle_info = handle_info_;
+    }
+    if( !old_handle_info || !command_interface || !data_receiver_ || old_handle_info->handle_type != HandleInfo::HANDLE_TYPE_UDP )
+    {
+        handler(false);
+        return;
+    }
+
+    // Release the old handle if the scanner still knows it, so it does not send twice to the receiver
+    const HandleInfo old = *old_handle_info;
+    command_interface->releaseHandleAsync(old.handle,[this,command_interface,old,handler](bool)
+    {
+        command_interface->requestHandleUDPAsync(old.port,old.hostname,old.start_angle,old.packet_type,[this,command_interface,handler](boost::optional<HandleInfo> handle_info)
+        {
+            if( !handle_info )
+            {
+                handler(false);
+                return;
+            }
+
+            // Take over the new handle right away, so it is released by the next attempt or by stopCapturing()
+            {
+                lock_guard<mutex> handle_lock(handle_mutex_);
+                handle_info_ = handle_info;
+            }
+            command_interface->startScanOutputAsync(handle_info->handle,[this,handler](bool started)
+            {
+                if( started )
+                {
+                    lock_guard<mutex> handle_lock(handle_mutex_);
+                    watchdog_feed_time_ = chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+                }
+                handler(started);
+            });
+        });
+    });
+}
+
+//-----------------------------------------------------------------------------
+shared_ptr<CommandInterface> R2000Driver::getCommandInterface() const
+{
+    lock_guard<mutex> handle_lock(handle_mutex_);
+    return command_interface_;
 }
 
 }
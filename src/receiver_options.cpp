@@ -0,0 +1,26 @@
+#include <receiver_options.h>
+#include <sched.h>
+using namespace std;
+
+namespace pepperl_fuchs {
+
+//-----------------------------------------------------------------------------
+bool setThreadAffinity(pthread_t thread, int cpu)
+{
+    if( cpu < 0 || cpu >= CPU_SETSIZE )
+        return false;
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu,&cpuset);
+    return pthread_setaffinity_np(thread,sizeof(cpu_set_t),&cpuset) == 0;
+}
+
+//-----------------------------------------------------------------------------
+bool setThreadRealtimePriority(pthread_t thread, int priority)
+{
+    sched_param param;
+    param.sched_priority = priority;
+    return pthread_setschedparam(thread,SCHED_FIFO,&param) == 0;
+}
+
+}
@@ -0,0 +1,130 @@
+#include <scanner_clock.h>
+using namespace std;
+
+namespace pepperl_fuchs {
+
+//-----------------------------------------------------------------------------
+ScannerClock::ScannerClock(int64_t window_ns, size_t num_windows) : window_ns_(window_ns), num_windows_(num_windows)
+{
+    reset();
+}
+
+//-----------------------------------------------------------------------------
+void ScannerClock::reset()
+{
+    windows_.clear();
+    has_current_ = false;
+    has_fit_ = false;
+    fit_scanner_ = 0;
+    fit_host_ = 0;
+    fit_drift_ = 0.0;
+}
+
+//-----------------------------------------------------------------------------
+void ScannerClock::addSample(uint64_t timestamp_raw, int64_t host_time_ns)
+{
+    Sample sample;
+    sample.scanner_ns = ntpToNanoseconds(timestamp_raw);
+    sample.host_ns = host_time_ns;
+
+    // A scanner clock running backwards or jumping far ahead invalidates the model
+    if( has_current_ )
+    {
+        const int64_t scanner_delta = int64_t(sample.scanner_ns - current_.scanner_ns);
+        const int64_t host_delta = sample.host_ns - current_.host_ns;
+        if( scanner_delta < -window_ns_ || scanner_delta - host_delta > 1000000000 )
+            reset();
+    }
+
+    if( !has_current_ )
+    {
+        current_ = sample;
+        window_start_ = sample.scanner_ns;
+        has_current_ = true;
+        updateFit();
+        return;
+    }
+
+    // Close the window once the sample lies behind it
+    if( int64_t(sample.scanner_ns - window_start_) >= window_ns_ )
+    {
+        windows_.push_back(current_);
+        if( windows_.size() > num_windows_ )
+            windows_.pop_front();
+        current_ = sample;
+        window_start_ = sample.scanner_ns;
+        updateFit();
+        return;
+    }
+
+    // Keep the sample received with the smallest latency, i.e. the smallest host-scanner difference
+    if( sample.host_ns - current_.host_ns < int64_t(sample.scanner_ns - current_.scanner_ns) )
+    {
+        current_ = sample;
+        if( windows_.size() < 2 )
+            updateFit();
+    }
+}
+
+//-----------------------------------------------------------------------------
+void ScannerClock::updateFit()
+{
+    has_fit_ = true;
+
+    // Offset only, until there are enough windows to estimate a drift
+    if( windows_.size() < 2 )
+    {
+        Sample best = current_;
+        for( const auto& s : windows_ )
+        {
+            if( s.host_ns - int64_t(s.scanner_ns) < best.host_ns - int64_t(best.scanner_ns) )
+                best = s;
+        }
+        fit_scanner_ = best.scanner_ns;
+        fit_host_ = best.host_ns;
+        fit_drift_ = 0.0;
+        return;
+    }
+
+    // Least squares on deviations (host-scanner offset over scanner time) relative to the newest window,
+    // keeps all values small enough for double precision
+    const Sample& ref = windows_.back();
+    double sum_x = 0, sum_y = 0, sum_xx = 0, sum_xy = 0;
+    for( const auto& s : windows_ )
+    {
+        const double x = double(int64_t(s.scanner_ns - ref.scanner_ns));
+        const double y = double((s.host_ns - ref.host_ns) - int64_t(s.scanner_ns - ref.scanner_ns));
+        sum_x += x;
+        sum_y += y;
+        sum_xx += x*x;
+        sum_xy += x*y;
+    }
+    const double n = windows_.size();
+    const double denominator = n*sum_xx - sum_x*sum_x;
+    const double slope = ( denominator != 0.0 ) ? (n*sum_xy - sum_x*sum_y)/denominator : 0.0;
+    const double intercept = (sum_y - slope*sum_x)/n;
+
+    // The line must not lie above any minimum, otherwise mapped times would precede receive times
+    double lift = 0.0;
+    for( const auto& s : windows_ )
+    {
+        const double x = double(int64_t(s.scanner_ns - ref.scanner_ns));
+        const double y = double((s.host_ns - ref.host_ns) - int64_t(s.scanner_ns - ref.scanner_ns));
+        lift = max(lift, intercept + slope*x - y);
+    }
+
+    fit_scanner_ = ref.scanner_ns;
+    fit_host_ = ref.host_ns + int64_t(intercept - lift);
+    fit_drift_ = slope;
+}
+
+//-----------------------------------------------------------------------------
+int64_t ScannerClock::toHostTime(uint64_t timestamp_raw) const
+{
+    if( !has_fit_ )
+        return 0;
+    const int64_t scanner_delta = int64_t(ntpToNanoseconds(timestamp_raw) - fit_scanner_);
+    return fit_host_ + scanner_delta + int64_t(double(scanner_delta)*fit_drift_);
+}
+
+}
@@ -0,0 +1,87 @@
+#include <scanner_manager.h>
+#include <iostream>
+using namespace std;
+
+namespace pepperl_fuchs {
+
+//-----------------------------------------------------------------------------
+ScannerManager::ScannerManager(unsigned int num_threads)
+{
+    next_thread_ = 0;
+    if( num_threads == 0 )
+        num_threads = max(boost::thread::hardware_concurrency(),1u);
+
+    for( unsigned int i=0; i<num_threads; i++ )
+    {
+        shared_ptr<boost::asio::io_service> io_service = make_shared<boost::asio::io_service>();
+        io_works_.push_back(make_shared<boost::asio::io_service::work>(*io_service));
+        io_threads_.push_back(make_shared<boost::thread>(boost::bind(&boost::asio::io_service::run, io_service.get())));
+        io_services_.push_back(io_service);
+    }
+}
+
+//-----------------------------------------------------------------------------
+ScannerManager::~ScannerManager()
+{
+    // Drivers wait for their socket handlers, so the IO threads must keep running until they are gone
+    scanners_.clear();
+
+    io_works_.clear();
+    for( size_t i=0; i<io_services_.size(); i++ )
+        io_services_[i]->stop();
+    for( size_t i=0; i<io_threads_.size(); i++ )
+        io_threads_[i]->join();
+}
+
+//-----------------------------------------------------------------------------
+size_t ScannerManager::addScanner(int io_thread)
+{
+    unsigned int thread_index;
+    if( io_thread >= 0 && io_thread < (int) io_services_.size() )
+        thread_index = io_thread;
+    else
+        thread_index = (next_thread_++) % io_services_.size();
+
+    scanners_.push_back(make_shared<R2000Driver>(*io_services_[thread_index]));
+    scanner_threads_.push_back(thread_index);
+    return scanners_.size()-1;
+}
+
+//-----------------------------------------------------------------------------
+bool ScannerManager::setThreadAffinity(unsigned int io_thread, int cpu)
+{
+    if( io_thread >= io_threads_.size() )
+        return false;
+
+    if( !pepperl_fuchs::setThreadAffinity(io_threads_[io_thread]->native_handle(),cpu) )
+    {
+        cerr << "ERROR: Could not pin IO thread " << io_thread << " to CPU " << cpu << endl;
+        return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool ScannerManager::setThreadPriority(unsigned int io_thread, int priority)
+{
+    if( io_thread >= io_threads_.size() )
+        return false;
+
+    if( !setThreadRealtimePriority(io_threads_[io_thread]->native_handle(),priority) )
+    {
+        cerr << "ERROR: Could not set SCHED_FIFO priority " << priority << " for IO thread " << io_thread << endl;
+        return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+vector<ReceiverStats> ScannerManager::getStats() const
+{
+    vector<ReceiverStats> stats;
+    for( size_t i=0; i<scanners_.size(); i++ )
+        stats.push_back(scanners_[i]->getReceiverStats());
+    return stats;
+}
+
+}